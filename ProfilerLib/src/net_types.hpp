@@ -6,6 +6,8 @@
 #include <string>
 #include <vector>
 #include <algorithm>
+#include <atomic>
+#include <cstdint>
 #include <optional>
 #include <unordered_map>
 #include <ranges>
@@ -271,11 +273,15 @@ class function_spec
     mutable std::optional<std::wstring> pretty_info_cache;
     mutable std::optional<std::pmr::wstring> pmr_pretty_info_cache;
 
+    // Key of the pretty info in function_table, 0 (the empty key) until the function is interned
+    mutable std::atomic<std::uint32_t> function_key;
+
 public:
     static const function_spec* UNKNOWN;
 
     explicit function_spec(FunctionID function_id, std::wstring&& name, const class_description* defining_class, const class_description* return_type, std::vector<const class_description*>&& arg_types, bool is_static)
         : internal_handle(function_id), name(std::move(name)), defining_class(defining_class), return_type(return_type), arg_types(std::move(arg_types)), m_is_static(is_static)
+        , function_key(0)
     {
     }
 
@@ -330,6 +336,19 @@ private:
     }
 
 public:
+    /// <summary>
+    /// Returns key of the pretty info in function_table, 0 until <see cref="function_table::intern"/> interns the function.
+    /// </summary>
+    [[nodiscard]] std::uint32_t get_function_key() const
+    {
+        return function_key.load(std::memory_order_acquire);
+    }
+
+    void set_function_key(std::uint32_t key) const
+    {
+        function_key.store(key, std::memory_order_release);
+    }
+
     [[nodiscard]] FunctionID get_internal_handle() const
     {
         return internal_handle;
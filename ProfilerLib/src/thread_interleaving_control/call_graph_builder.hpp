@@ -0,0 +1,127 @@
+#pragma once
+
+#include "trace.hpp"
+
+#include "../utils/spill_memory_resource.hpp"
+#include "../utils/tree_graph.hpp"
+
+#include <algorithm>
+#include <exception>
+#include <future>
+#include <memory>
+#include <memory_resource>
+#include <thread>
+#include <vector>
+
+/// <summary>
+/// Builds the call graph from many stored traces on several threads.
+///
+/// Traces are split into contiguous ranges, every worker adds the paths of its range to a graph of its own and
+/// the graphs are merged pairwise (a range into the preceding one, independent pairs in parallel). Edges are thus
+/// ordered by their first appearance, the result is the same as adding the traces one by one.
+/// Ranges balance better than subtrees keyed by the first edge, most traces start with the same call.
+/// With a memory budget (the call graph is on a spill_memory_resource), graphs of the other workers share the budget left.
+/// </summary>
+class call_graph_builder
+{
+    static constexpr std::size_t MIN_TRACES_PER_WORKER = 512;
+
+public:
+    /// <summary>
+    /// Adds paths of all traces (mapped_trace_file or mapped_trace_store) to the call graph, values are not updated
+    /// (<see cref="call_graph_utils::compute_values"/>). mem_res is used only by the calling thread.
+    /// </summary>
+    template<typename Traces, typename Alloc>
+    static void add_paths(const Traces& traces, tree_graph<int, past_trace_item, std::equal_to<>, Alloc>& call_graph, std::pmr::memory_resource* mem_res)
+    {
+        std::size_t traces_count = traces.traces_size();
+        std::size_t workers = workers_count(traces_count);
+        if (workers <= 1)
+        {
+            add_range(traces, 0, traces_count, call_graph, mem_res);
+            return;
+        }
+
+        auto range_begin = [traces_count, workers](std::size_t worker) { return traces_count * worker / workers; };
+
+        // Graphs of workers other than the first one, resources are destroyed after the graphs
+        auto* spill_resource = dynamic_cast<spill_memory_resource*>(mem_res);
+        std::vector<std::unique_ptr<std::pmr::memory_resource>> resources;
+        std::vector<pmr::tree_graph<int, past_trace_item>> graphs;
+        resources.reserve(workers - 1);
+        graphs.reserve(workers - 1);
+        for (std::size_t i = 1; i < workers; ++i)
+        {
+            if (spill_resource)
+                resources.push_back(spill_resource->make_worker_resource(i, workers, std::pmr::get_default_resource()));
+            else
+                resources.push_back(std::make_unique<std::pmr::unsynchronized_pool_resource>());
+            graphs.emplace_back(resources.back().get());
+        }
+
+        std::vector<std::future<void>> tasks;
+        for (std::size_t i = 1; i < workers; ++i)
+        {
+            tasks.push_back(std::async(std::launch::async, [&, i]
+            {
+                add_range(traces, range_begin(i), range_begin(i + 1), graphs[i - 1], resources[i - 1].get());
+            }));
+        }
+        add_range(traces, 0, range_begin(1), call_graph, mem_res);
+        wait(tasks);
+
+        // Merging into the call graph stays on the calling thread
+        for (std::size_t step = 1; step < workers; step *= 2)
+        {
+            for (std::size_t i = 2 * step; i + step < workers; i += 2 * step)
+                tasks.push_back(std::async(std::launch::async, [&, i, step] { call_graph_utils::merge_paths(graphs[i - 1], graphs[i + step - 1]); }));
+            call_graph_utils::merge_paths(call_graph, graphs[step - 1]);
+            wait(tasks);
+        }
+    }
+
+private:
+    static std::size_t workers_count(std::size_t traces_count)
+    {
+        std::size_t threads = std::max(1u, std::thread::hardware_concurrency());
+        return std::clamp<std::size_t>(traces_count / MIN_TRACES_PER_WORKER, 1, threads);
+    }
+
+    template<typename Traces, typename Alloc>
+    static void add_range(const Traces& traces, std::size_t first, std::size_t last, tree_graph<int, past_trace_item, std::equal_to<>, Alloc>& call_graph,
+        std::pmr::memory_resource* mem_res)
+    {
+        // Views avoid copying the function ids of edges that are already in the graph
+        std::pmr::vector<past_trace_item_view> trace(mem_res);
+        for (std::size_t i = first; i < last; ++i)
+        {
+            trace.clear();
+            traces.for_each_item(i, [&trace](const past_trace_item_view& item) { trace.push_back(item); });
+            call_graph_utils::add_path(call_graph, trace);
+        }
+    }
+
+    /// <summary>
+    /// Waits for all tasks, the first exception is rethrown once none of them runs.
+    /// </summary>
+    static void wait(std::vector<std::future<void>>& tasks)
+    {
+        std::exception_ptr error;
+        for (auto& task : tasks)
+        {
+            try
+            {
+                task.get();
+            }
+            catch (...)
+            {
+                if (!error)
+                    error = std::current_exception();
+            }
+        }
+        tasks.clear();
+
+        if (error)
+            std::rethrow_exception(error);
+    }
+};
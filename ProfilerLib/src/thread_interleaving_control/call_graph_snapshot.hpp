@@ -0,0 +1,283 @@
+#pragma once
+
+#include "call_graph_builder.hpp"
+#include "trace.hpp"
+#include "trace_store.hpp"
+
+#include "../utils/binary_buffer.hpp"
+#include "../utils/binary_fstream.hpp"
+#include "../utils/binary_reader.hpp"
+#include "../utils/mapped_file.hpp"
+#include "../utils/tree_graph.hpp"
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <unordered_map>
+#include <filesystem>
+#include <memory_resource>
+
+#include <Windows.h>
+
+/// <summary>
+/// Call graph built from the data file (including the computed vertex values) persisted in 'data_file.graph',
+/// so a new process does not need to replay every stored trace.
+///
+/// Layout:
+///   u32 SNAPSHOT_MAGIC, u32 version
+///   size_t segments_count, segments: { wstring file_name, size_t traces_count, size_t last_trace_offset }
+///   size_t strings_count, wstring function_ids[strings_count]
+///   vertices in pre-order: { int value, u32 edges_count, u8 collapsed, edges: { size_t counted_id, u32 function_index, size_t options_size, u64 backtrack, u64 asleep, child vertex } }
+///
+/// Exhausted subtrees are collapsed before saving (<see cref="call_graph_utils::collapse_exhausted"/>), so the size of
+/// the snapshot and the load time follow the unexplored part of the graph rather than all stored traces.
+/// Only traces not covered by the snapshot are replayed. The snapshot is rewritten once at least
+/// REWRITE_THRESHOLD traces are not covered, so the replayed suffix stays short while the rewrite is amortized.
+/// The snapshot is replaced atomically, concurrent workers never see a partial one.
+/// </summary>
+class call_graph_snapshot
+{
+    static constexpr std::uint32_t SNAPSHOT_MAGIC = 0x47434654; // "TFCG"
+    static constexpr std::uint32_t SNAPSHOT_VERSION = 4;
+    static constexpr std::size_t REWRITE_THRESHOLD = 32;
+
+public:
+    static std::wstring snapshot_path(const std::wstring& data_file_path)
+    {
+        return data_file_path + L".graph";
+    }
+
+    /// <summary>
+    /// Same result as <see cref="mapped_trace_store::populate_call_graph"/> on an empty graph followed by <see cref="call_graph_utils::collapse_exhausted"/>, except that with several
+    /// segments, edges first seen in traces recorded after the snapshot might be ordered differently.
+    /// </summary>
+    template<typename Alloc>
+    static void populate_call_graph(const std::wstring& data_file_path, tree_graph<int, past_trace_item, std::equal_to<>, Alloc>& call_graph, std::pmr::memory_resource* mem_res)
+    {
+        auto paths = trace_store::segment_paths(data_file_path);
+        std::vector<mapped_trace_file> segments;
+        segments.reserve(paths.size());
+        for (const auto& path : paths)
+        {
+            if (!segments.emplace_back(path))
+                throw profiler_error(L"Corrupted data_file " + path);
+        }
+
+        std::vector<std::size_t> covered(segments.size(), 0);
+        bool loaded = load(data_file_path, paths, segments, covered, call_graph);
+        if (!loaded)
+            std::ranges::fill(covered, 0);
+
+        // Few traces recorded since the snapshot only propagate their changes, the whole graph is built in parallel
+        // and computed once otherwise
+        std::size_t uncovered = 0;
+        for (std::size_t i = 0; i < segments.size(); ++i)
+        {
+            uncovered += segments[i].traces_size() - covered[i];
+            if (!loaded)
+                call_graph_builder::add_paths(segments[i], call_graph, mem_res);
+            else if constexpr (std::is_same_v<Alloc, std::pmr::polymorphic_allocator<past_trace_item>>)
+                segments[i].populate_call_graph(call_graph, mem_res, covered[i], call_graph_utils::values_update::INCREMENTAL);
+            else
+                segments[i].populate_call_graph(call_graph, covered[i], call_graph_utils::values_update::INCREMENTAL);
+        }
+        if (!loaded)
+            call_graph_utils::compute_values(call_graph);
+        call_graph_utils::collapse_exhausted(call_graph);
+
+        if (!loaded || uncovered >= REWRITE_THRESHOLD)
+            save(data_file_path, paths, segments, call_graph);
+    }
+
+private:
+    template<typename Alloc>
+    static bool load(const std::wstring& data_file_path, const std::vector<std::wstring>& paths, const std::vector<mapped_trace_file>& segments, std::vector<std::size_t>& covered,
+        tree_graph<int, past_trace_item, std::equal_to<>, Alloc>& call_graph)
+    {
+        mapped_file snapshot(snapshot_path(data_file_path));
+        if (!snapshot || snapshot.size() == 0)
+            return false;
+
+        binary_reader reader(snapshot.data());
+        std::uint32_t magic = 0, version = 0;
+        if (!reader.read(magic) || !reader.read(version) || magic != SNAPSHOT_MAGIC || version != SNAPSHOT_VERSION)
+            return false;
+
+        // Every covered segment must still contain the same traces, otherwise the graph is rebuilt
+        std::size_t segments_count = 0;
+        if (!reader.read(segments_count))
+            return false;
+        for (std::size_t i = 0; i < segments_count; ++i)
+        {
+            std::wstring_view file_name;
+            std::size_t traces_count = 0, last_trace_offset = 0;
+            if (!reader.read(file_name) || !reader.read(traces_count) || !reader.read(last_trace_offset))
+                return false;
+
+            auto segment = std::ranges::find_if(paths, [file_name](const std::wstring& path) { return std::filesystem::path(path).filename() == file_name; });
+            if (segment == paths.end())
+                return false;
+
+            auto index = static_cast<std::size_t>(segment - paths.begin());
+            if (traces_count > segments[index].traces_size()
+                || (traces_count > 0 && segments[index].get_trace_offset(traces_count - 1) != last_trace_offset))
+                return false;
+            covered[index] = traces_count;
+        }
+
+        std::size_t strings_count = 0;
+        if (!reader.read(strings_count) || strings_count > reader.remaining())
+            return false;
+        std::vector<std::wstring_view> dictionary(strings_count);
+        for (auto& function_id : dictionary)
+        {
+            if (!reader.read(function_id))
+                return false;
+        }
+
+        // Graph is built only from a valid snapshot, so it is never left half-populated
+        if (!validate_graph(reader, dictionary.size()))
+            return false;
+
+        std::vector<function_table::key_t> function_keys;
+        function_keys.reserve(dictionary.size());
+        for (auto function_id : dictionary)
+            function_keys.push_back(function_table::get_instance().intern(function_id));
+
+        using graph_vertex = typename tree_graph<int, past_trace_item, std::equal_to<>, Alloc>::graph_vertex;
+
+        std::uint32_t edges_count = 0;
+        std::uint8_t collapsed = 0;
+        reader.read(call_graph.root().value);
+        reader.read(edges_count);
+        reader.read(collapsed);
+
+        // remaining edges of vertices on the current path
+        std::vector<std::pair<graph_vertex*, std::size_t>> stack{ { &call_graph.root(), edges_count } };
+        while (!stack.empty())
+        {
+            auto& [vertex, remaining_edges] = stack.back();
+            if (remaining_edges == 0)
+            {
+                stack.pop_back();
+                continue;
+            }
+            --remaining_edges;
+
+            past_trace_item edge;
+            std::uint32_t function_index = 0;
+            int value = 0;
+            reader.read(edge.counted_id);
+            reader.read(function_index);
+            reader.read(edge.options_size);
+            reader.read(edge.backtrack);
+            reader.read(edge.asleep);
+            reader.read(value);
+            reader.read(edges_count);
+            reader.read(collapsed);
+            edge.function_key = function_keys[function_index];
+
+            auto& child = vertex->add_edge(std::move(edge), value);
+            if (collapsed)
+                call_graph.collapse(child);
+            stack.emplace_back(&child, edges_count);
+        }
+
+        return true;
+    }
+
+    static bool validate_graph(binary_reader reader, std::size_t dictionary_size)
+    {
+        int value = 0;
+        std::uint32_t edges_count = 0;
+        std::uint8_t collapsed = 0;
+        if (!reader.read(value) || !reader.read(edges_count) || !reader.read(collapsed) || collapsed > 1)
+            return false;
+
+        std::vector<std::size_t> remaining_edges{ edges_count };
+        while (!remaining_edges.empty())
+        {
+            if (remaining_edges.back() == 0)
+            {
+                remaining_edges.pop_back();
+                continue;
+            }
+            --remaining_edges.back();
+
+            std::size_t counted_id = 0, options_size = 0;
+            std::uint32_t function_index = 0;
+            std::uint64_t backtrack = 0, asleep = 0;
+            if (!reader.read(counted_id) || !reader.read(function_index) || !reader.read(options_size) || !reader.read(backtrack) || !reader.read(asleep)
+                || !reader.read(value) || !reader.read(edges_count) || !reader.read(collapsed) || function_index >= dictionary_size
+                || (collapsed && (edges_count > 0 || value != 0)))
+                return false;
+            remaining_edges.push_back(edges_count);
+        }
+
+        return reader.remaining() == 0;
+    }
+
+    template<typename Alloc>
+    static void save(const std::wstring& data_file_path, const std::vector<std::wstring>& paths, const std::vector<mapped_trace_file>& segments,
+        tree_graph<int, past_trace_item, std::equal_to<>, Alloc>& call_graph)
+    {
+        using graph_vertex = typename tree_graph<int, past_trace_item, std::equal_to<>, Alloc>::graph_vertex;
+
+        binary_buffer header;
+        header << SNAPSHOT_MAGIC << SNAPSHOT_VERSION << segments.size();
+        for (std::size_t i = 0; i < segments.size(); ++i)
+        {
+            std::size_t traces_count = segments[i].traces_size();
+            header << std::filesystem::path(paths[i]).filename().wstring() << traces_count
+                << (traces_count > 0 ? segments[i].get_trace_offset(traces_count - 1) : std::size_t{ 0 });
+        }
+
+        std::vector<std::wstring_view> dictionary;
+        std::unordered_map<function_table::key_t, std::uint32_t> dictionary_index;
+
+        binary_buffer graph;
+        graph << call_graph.root().value << static_cast<std::uint32_t>(call_graph.root().edges_size())
+            << static_cast<std::uint8_t>(call_graph.root().is_collapsed());
+
+        std::vector<std::pair<const graph_vertex*, std::size_t>> stack{ { &call_graph.root(), 0 } };
+        while (!stack.empty())
+        {
+            auto [vertex, index] = stack.back();
+            if (index == vertex->edges_size())
+            {
+                stack.pop_back();
+                continue;
+            }
+            ++stack.back().second;
+
+            const auto& edge = vertex->get_edge(index);
+            auto [iter, inserted] = dictionary_index.try_emplace(edge.function_key, static_cast<std::uint32_t>(dictionary.size()));
+            if (inserted)
+                dictionary.push_back(edge.function_id());
+
+            const auto& child = vertex->next_vertex(index);
+            graph << edge.counted_id << iter->second << edge.options_size << edge.backtrack << edge.asleep << child.value << static_cast<std::uint32_t>(child.edges_size())
+                << static_cast<std::uint8_t>(child.is_collapsed());
+            stack.emplace_back(&child, 0);
+        }
+
+        header << dictionary.size();
+        for (auto function_id : dictionary)
+            header << function_id;
+
+        // Write aside and swap, readers and other workers see either the old or the new snapshot
+        auto path = snapshot_path(data_file_path);
+        auto temporary_snapshot = path + L"." + std::to_wstring(GetCurrentProcessId()) + L".tmp";
+        {
+            binary_fstream stream(temporary_snapshot, binary_fstream::output);
+            stream.write(header.bytes()).write(graph.bytes());
+            if (!stream)
+                return;
+        }
+        if (!MoveFileEx(temporary_snapshot.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING))
+        {
+            std::error_code ec;
+            std::filesystem::remove(temporary_snapshot, ec);
+        }
+    }
+};
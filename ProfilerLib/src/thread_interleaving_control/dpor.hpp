@@ -0,0 +1,184 @@
+#pragma once
+
+#include "trace.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <cstdint>
+#include <memory_resource>
+#include <span>
+#include <unordered_map>
+#include <vector>
+
+/// <summary>
+/// Dynamic partial-order reduction of recorded traces (Flanagan and Godefroid).
+///
+/// Two steps are dependent if they call a function on the same object (<see cref="thread_info::current_object"/>),
+/// steps with an unknown object depend on every step. Happens-before is tracked by vector clocks over the dependent
+/// steps. For every pair of dependent steps which are not ordered by happens-before, the later thread is added to the
+/// backtrack set of the earlier step (all threads frozen there if it was not), only these orderings need to be explored.
+/// Every item stores its backtrack set (<see cref="trace_item::backtrack"/>) and its options become the size of it.
+/// Call graphs merge the sets of all traces through a vertex, its unexplored options are the threads of the merged set
+/// without an edge there (see call_graph_utils::unexplored_options).
+/// </summary>
+namespace dpor
+{
+    /// <summary>
+    /// Threads with counted id below this are tracked, frozen threads of items with a greater one are unknown.
+    /// </summary>
+    static constexpr std::size_t MAX_THREADS = 64;
+
+    /// <summary>
+    /// Returns true if calls on the objects are dependent, unknown objects are dependent with everything.
+    /// </summary>
+    inline bool are_dependent(net_reference lhs, net_reference rhs)
+    {
+        return !lhs || !rhs || lhs == rhs;
+    }
+
+    /// <summary>
+    /// Returns mask of counted ids of the threads, <see cref="trace_item::frozen_threads"/>.
+    /// Returns 0 if some counted id is MAX_THREADS or more, the decision is not reduced then.
+    /// </summary>
+    template<std::ranges::range ThreadInfosRange>
+    std::uint64_t threads_mask(ThreadInfosRange&& thread_infos)
+    {
+        std::uint64_t mask = 0;
+        for (const thread_info* thr_info : thread_infos)
+        {
+            std::size_t counted_id = thr_info->get_thread_id().counted_id;
+            if (counted_id >= MAX_THREADS)
+                return 0;
+            mask |= std::uint64_t{ 1 } << counted_id;
+        }
+        return mask;
+    }
+
+    /// <summary>
+    /// Step of a trace as seen by the reduction.
+    /// </summary>
+    struct step
+    {
+        std::size_t counted_id;
+        net_reference object; // see thread_info::current_object
+        std::uint64_t frozen_threads; // see threads_mask
+    };
+
+    /// <summary>
+    /// Returns the backtrack set of every step, it still has to be limited to the frozen threads of the step (see reduce_step).
+    /// </summary>
+    inline std::pmr::vector<std::uint64_t> backtrack_sets(std::span<const step> steps, std::pmr::memory_resource* mem_res)
+    {
+        using vector_clock = std::pmr::vector<std::size_t>;
+
+        // Vector clocks hold 1 + index of the last step of every thread known to happen before
+        std::pmr::vector<vector_clock> step_clocks(mem_res);
+        std::pmr::vector<vector_clock> thread_clocks(MAX_THREADS, vector_clock(MAX_THREADS, 0, mem_res), mem_res);
+        std::pmr::vector<std::uint64_t> backtrack(steps.size(), 0, mem_res);
+
+        // Last step of every thread per object, and last step of every thread on any object
+        std::pmr::unordered_map<net_reference, vector_clock> last_object_steps(mem_res);
+        vector_clock last_steps(MAX_THREADS, 0, mem_res);
+        vector_clock last_unknown_steps(MAX_THREADS, 0, mem_res);
+
+        step_clocks.reserve(steps.size());
+        for (std::size_t i = 0; i < steps.size(); ++i)
+        {
+            const step& item = steps[i];
+            std::size_t thread = item.counted_id;
+            if (thread >= MAX_THREADS)
+            {
+                // Untracked thread, the step is ordered after everything
+                step_clocks.push_back(last_steps);
+                continue;
+            }
+            backtrack[i] |= std::uint64_t{ 1 } << thread;
+
+            vector_clock* object_steps = nullptr;
+            if (item.object)
+                object_steps = &last_object_steps.try_emplace(item.object, MAX_THREADS, 0).first->second;
+
+            vector_clock clock = thread_clocks[thread];
+            std::size_t race = 0;
+            for (std::size_t other = 0; other < MAX_THREADS; ++other)
+            {
+                if (other == thread)
+                    continue;
+
+                // Last dependent step of the other thread
+                std::size_t dependent = object_steps ? std::max((*object_steps)[other], last_unknown_steps[other]) : last_steps[other];
+                if (dependent == 0)
+                    continue;
+
+                if (thread_clocks[thread][other] < dependent)
+                    race = std::max(race, dependent);
+
+                const vector_clock& dependent_clock = step_clocks[dependent - 1];
+                for (std::size_t j = 0; j < MAX_THREADS; ++j)
+                    clock[j] = std::max(clock[j], dependent_clock[j]);
+            }
+
+            if (race != 0)
+            {
+                const step& raced = steps[race - 1];
+                bool was_frozen = raced.frozen_threads & (std::uint64_t{ 1 } << thread);
+                backtrack[race - 1] |= was_frozen ? std::uint64_t{ 1 } << thread : raced.frozen_threads;
+            }
+
+            clock[thread] = i + 1;
+            thread_clocks[thread] = clock;
+            step_clocks.push_back(std::move(clock));
+
+            last_steps[thread] = i + 1;
+            if (object_steps)
+                (*object_steps)[thread] = i + 1;
+            else
+                last_unknown_steps[thread] = i + 1;
+        }
+
+        return backtrack;
+    }
+
+    /// <summary>
+    /// Sets the backtrack set of the item (trace_item or past_trace_item) of the step and replaces its options by the size of the set.
+    /// Items without frozen threads (see threads_mask) keep their options and have no backtrack set.
+    /// </summary>
+    template<typename Item>
+    void reduce_step(Item& item, const step& step, std::uint64_t backtrack)
+    {
+        if (step.frozen_threads == 0 || step.counted_id >= MAX_THREADS)
+            return;
+
+        // The thread of the step is an option even if it was not frozen before
+        item.backtrack = (backtrack & step.frozen_threads) | (std::uint64_t{ 1 } << step.counted_id);
+        item.options_size = std::popcount(item.backtrack);
+    }
+
+    /// <summary>
+    /// Sets the backtrack sets of the items of the trace and replaces their options by the sizes of the sets.
+    /// </summary>
+    inline void reduce_options(trace& trace, std::pmr::memory_resource* mem_res)
+    {
+        std::pmr::vector<step> steps(mem_res);
+        trace.for_each([&steps](const trace_item& item) { steps.push_back({ item.thr_id.counted_id, item.object, item.frozen_threads }); });
+
+        auto backtrack = backtrack_sets(steps, mem_res);
+        std::size_t i = 0;
+        trace.for_each([&](trace_item& item)
+        {
+            reduce_step(item, steps[i], backtrack[i]);
+            ++i;
+        });
+    }
+
+    /// <summary>
+    /// Same as for the trace, for a stored trace whose steps are known (e.g. recovered from a journal).
+    /// </summary>
+    template<typename Alloc>
+    void reduce_options(std::vector<past_trace_item, Alloc>& past_trace, std::span<const step> steps, std::pmr::memory_resource* mem_res)
+    {
+        auto backtrack = backtrack_sets(steps, mem_res);
+        for (std::size_t i = 0; i < past_trace.size() && i < steps.size(); ++i)
+            reduce_step(past_trace[i], steps[i], backtrack[i]);
+    }
+}
@@ -11,6 +11,7 @@ class driver_base
 
 protected:
     const thread_preemption_bound& thread_preemption_bound;
+    std::uint64_t asleep_threads = 0;
 
 public:
     driver_base(const cor_profiler& profiler, std::pmr::memory_resource* mem_resource, const ::thread_preemption_bound& thread_preemption_bound)
@@ -23,6 +24,22 @@ public:
         return profiler;
     }
 
+    /// <summary>
+    /// Returns mask of counted ids of the frozen threads the last decision left asleep (see past_trace_item::asleep),
+    /// they stay options of the stored trace and the call graph does not count them as unexplored.
+    /// </summary>
+    [[nodiscard]] std::uint64_t get_asleep_threads() const
+    {
+        return asleep_threads;
+    }
+
+    /// <summary>
+    /// Called once the trace of the run is recorded in the data file.
+    /// </summary>
+    virtual void on_trace_recorded()
+    {
+    }
+
     driver_base(const driver_base&) = default;
     driver_base(driver_base&&) noexcept = default;
 
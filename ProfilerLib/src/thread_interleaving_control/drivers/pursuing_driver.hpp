@@ -3,6 +3,7 @@
 #include "driver_base.hpp"
 #include "../thread_info.hpp"
 #include "../trace.hpp"
+#include "../trace_store.hpp"
 #include "../thread_preemption_bound.hpp"
 
 #include "../../config_file.hpp"
@@ -22,13 +23,12 @@ public:
         : driver_base(profiler, mem_resource, tpb)
         , cur_index(0)
     {
-        auto path = config_file::get_instance().get_value(L"data_file");
-        if (std::filesystem::is_empty(path))
+        mapped_trace_store trace_log(config_file::get_instance().get_value(L"data_file"));
+        if (!trace_log || trace_log.traces_size() == 0)
             throw profiler_error(L"No data file for pursuing driver.");
 
         auto trace_index = 0; // ToDo: select which
 
-        trace_file trace_log(path);
         trace_log.get_trace(trace_index, pursuing_trace);
     }
 
@@ -46,7 +46,7 @@ public:
             {
                 if (pursuing_trace[current_index].counted_id == thr_info->get_thread_id().counted_id)
                 {
-                    if (!thr_info->call_stack || pursuing_trace[current_index].function_id.compare(thr_info->call_stack->back()->get_pretty_info(get_memory_resource())))
+                    if (!thr_info->call_stack || pursuing_trace[current_index].function_key != function_table::get_instance().intern(thr_info->call_stack->back()))
                     {
                         // can't log, as logging locks a mutex for thread safe io
                         // log_async<logging_level::VERBOSE>(L"Stage ", current_index, ": Complete match");
@@ -3,17 +3,26 @@
 #include "driver_base.hpp"
 #include "../thread_info.hpp"
 #include "../trace.hpp"
+#include "../trace_store.hpp"
+#include "../call_graph_snapshot.hpp"
+#include "../dpor.hpp"
+#include "../frontier_board.hpp"
+#include "../preemption_bounding.hpp"
 #include "../thread_preemption_bound.hpp"
 
 #include "../../config_file.hpp"
 #include "../../thread_safe_logger.hpp"
+#include "../../utils/spill_memory_resource.hpp"
 #include "../../utils/tree_graph.hpp"
 
 #include <vector>
+#include <unordered_map>
+#include <memory>
 #include <random>
 #include <algorithm>
 #include <utility>
 #include <chrono>
+#include <optional>
 #include <iostream>
 
 #include <windows.h>
@@ -28,16 +37,57 @@ class systematic_driver : public driver_base
         RANDOM,
     };
 
-    trace_file trace_file;
+    // Set when the call graph has a memory budget, must outlive the call graph
+    std::unique_ptr<spill_memory_resource> call_graph_resource;
     pmr::tree_graph<int, past_trace_item> call_graph;
     const decltype(call_graph)::graph_vertex* current_vertex;
 
+    // Edges of the current vertex by their thread and function, rebuilt when the driver enters another vertex
+    std::pmr::unordered_map<past_trace_item, std::size_t, past_trace_item_hash> current_edges;
+    const decltype(call_graph)::graph_vertex* indexed_vertex;
+
     std::size_t seed;
     std::mt19937 rng_engine;
 
     std::wofstream extra_log;
     std::chrono::steady_clock::time_point profiler_start;
     search_type_t search_type;
+    bool partial_order_reduction;
+
+    /// <summary>
+    /// Step of a thread whose subtree was explored from an equivalent state, running it again before a dependent step
+    /// leads to explored states only.
+    /// </summary>
+    struct sleeping_step
+    {
+        std::size_t counted_id;
+        function_table::key_t function_key;
+        net_reference object;
+    };
+
+    bool sleep_sets;
+    std::pmr::vector<sleeping_step> sleep_set;
+
+    // Iterative preemption bounding, preemptions of this run and the thread of the previous step
+    static constexpr std::size_t NO_THREAD = static_cast<std::size_t>(-1);
+    bool preemption_bounding;
+    std::size_t preemption_bound;
+    std::size_t preemptions;
+    std::size_t last_counted_id;
+
+    // Set when several workers explore the data file at the same time, claims are read once per decision
+    std::unique_ptr<frontier_board> frontier;
+    std::optional<std::pmr::unordered_map<std::uint64_t, std::size_t>> decision_claims;
+    std::pmr::unordered_map<function_table::key_t, std::size_t> function_hashes;
+
+    // Targeted replay, edge indices from the current vertex to the target (vertex with unexplored options), empty if there is none
+    static constexpr std::chrono::milliseconds RESYNC_TIMEOUT{ 50 };
+    bool targeted_replay;
+    std::pmr::vector<std::size_t> target_path;
+    std::size_t target_depth;
+    bool has_target;
+    std::optional<std::chrono::steady_clock::time_point> resync_deadline;
+    std::size_t waiting_frozen; // frozen threads when the decision started waiting for the thread of the target
 
     template<typename... Ts>
     void log(Ts&&... ts)
@@ -75,7 +125,7 @@ class systematic_driver : public driver_base
     [[nodiscard]] std::pmr::wstring format_edge(const past_trace_item& edge) const
     {
         std::pmr::wstring edge_str(get_memory_resource());
-        std::format_to(std::back_inserter(edge_str), L"{} {} {}", edge.counted_id, edge.function_id, edge.options_size);
+        std::format_to(std::back_inserter(edge_str), L"{} {} {}", edge.counted_id, edge.function_id(), edge.options_size);
         return edge_str;
     }
 
@@ -90,17 +140,37 @@ class systematic_driver : public driver_base
         throw profiler_error(L"Unknown search_type strategy");
     }
 
+    static std::unique_ptr<spill_memory_resource> create_call_graph_resource(std::pmr::memory_resource* mem_resource)
+    {
+        int memory_budget = config_file::get_instance().get_value<int>(L"call_graph_memory_budget");
+        if (memory_budget <= 0)
+            return nullptr;
+
+        auto spill_path = config_file::get_instance().get_value(L"data_file") + L"." + std::to_wstring(GetCurrentProcessId()) + L".spill";
+        return std::make_unique<spill_memory_resource>(std::move(spill_path), static_cast<std::size_t>(memory_budget) * 1024 * 1024, mem_resource);
+    }
+
+    [[nodiscard]] std::pmr::memory_resource* get_call_graph_resource() const
+    {
+        return call_graph_resource ? call_graph_resource.get() : get_memory_resource();
+    }
+
 public:
     systematic_driver(const systematic_driver&) = delete;
 
     systematic_driver(systematic_driver&& other) noexcept
         : driver_base(other.get_profiler(), other.get_memory_resource(), other.thread_preemption_bound)
-        , trace_file(std::move(other.trace_file))
-        , call_graph(std::move(other.call_graph))
-        , current_vertex(&call_graph.root())
+        , call_graph_resource(std::move(other.call_graph_resource)), call_graph(std::move(other.call_graph))
+        , current_vertex(&call_graph.root()), current_edges(other.get_memory_resource()), indexed_vertex(nullptr)
         , seed(other.seed), rng_engine(other.rng_engine)
         , extra_log(std::move(other.extra_log)), profiler_start(other.profiler_start)
-        , search_type(other.search_type)
+        , search_type(other.search_type), partial_order_reduction(other.partial_order_reduction)
+        , sleep_sets(other.sleep_sets), sleep_set(std::move(other.sleep_set))
+        , preemption_bounding(other.preemption_bounding), preemption_bound(other.preemption_bound)
+        , preemptions(other.preemptions), last_counted_id(other.last_counted_id)
+        , frontier(std::move(other.frontier)), decision_claims(std::move(other.decision_claims)), function_hashes(std::move(other.function_hashes))
+        , targeted_replay(other.targeted_replay), target_path(std::move(other.target_path)), target_depth(other.target_depth)
+        , has_target(other.has_target), resync_deadline(other.resync_deadline), waiting_frozen(other.waiting_frozen)
     {
     }
 
@@ -110,33 +180,83 @@ public:
 
     systematic_driver(const cor_profiler& profiler, std::pmr::memory_resource* mem_resource, const ::thread_preemption_bound& tpb, std::size_t seed = std::random_device{}())
         : driver_base(profiler, mem_resource, tpb)
-        , trace_file(config_file::get_instance().get_value(L"data_file"))
-        , call_graph(mem_resource), current_vertex(&call_graph.root())
+        , call_graph_resource(create_call_graph_resource(mem_resource)), call_graph(get_call_graph_resource()), current_vertex(&call_graph.root())
+        , current_edges(mem_resource), indexed_vertex(nullptr)
         , seed(seed), rng_engine(seed)
         , search_type(search_type_t::FIRST)
+        , partial_order_reduction(config_file::get_instance().get_value(L"partial_order_reduction") == L"dpor")
+        , sleep_sets(false), sleep_set(mem_resource)
+        , preemption_bounding(false), preemption_bound(0), preemptions(0), last_counted_id(NO_THREAD)
+        , function_hashes(mem_resource)
+        , targeted_replay(false), target_path(mem_resource), target_depth(0), has_target(false), waiting_frozen(0)
     {
-        if (!trace_file)
+        const std::wstring& data_file_path = config_file::get_instance().get_value(L"data_file");
+        if (!::trace_file(data_file_path)) // creates the data file on first run
             throw profiler_error(L"Invalid data_file");
 
         auto& params = config_file::get_instance().get_values(L"debug_type");
         if (params.size() > 1)
             search_type = get_search_type(params[1]);
-        if (params.size() > 2)
+        for (std::size_t i = 2; i < params.size(); ++i)
         {
-            extra_log = std::wofstream(params[2], std::ios::app);
-            extra_log << L"[ NEW ITERATION (search_type=" << params[1] << L") ]" << std::endl;
+            if (params[i] == L"sleep_sets")
+                sleep_sets = true;
+            else if (params[i] == L"preemption_bounding")
+                preemption_bounding = true;
+            else if (params[i] == L"targeted_replay")
+                targeted_replay = true;
+            else
+            {
+                extra_log = std::wofstream(params[i], std::ios::app);
+                extra_log << L"[ NEW ITERATION (search_type=" << params[1] << L") ]" << std::endl;
+            }
+        }
+
+        if (config_file::get_instance().get_value(L"parallel_exploration") == L"on")
+        {
+            if (!trace_store::segments_enabled())
+                throw profiler_error(L"parallel_exploration needs data_file_segments = on");
+
+            // Claims are read before the call graph, traces recorded while it loads stay claimed
+            frontier = std::make_unique<frontier_board>(data_file_path);
+            if (!*frontier)
+                log(L"Frontier board is full, exploring without coordination");
+        }
+
+        if (config_file::get_instance().get_value(L"call_graph_snapshot") == L"off")
+        {
+            mapped_trace_store data_file(data_file_path);
+            if (!data_file)
+                throw profiler_error(L"Corrupted data_file");
+            data_file.populate_call_graph(call_graph, get_call_graph_resource());
+            call_graph_utils::collapse_exhausted(call_graph);
         }
+        else
+            call_graph_snapshot::populate_call_graph(data_file_path, call_graph, get_call_graph_resource());
 
-        trace_file.populate_call_graph(call_graph, mem_resource);
+        if (preemption_bounding)
+            update_preemption_bound(data_file_path);
 
         TreePruner::prune_tree(call_graph, extra_log);
 
+        if (call_graph_resource)
+        {
+            // Pages of the spilled vertices come back only when the run walks them
+            log(L"Call graph spilled ", call_graph_resource->spilled_size() / 1024, L" KB (", call_graph_resource->resident_size() / 1024, L" KB resident)");
+            call_graph_resource->trim();
+        }
+
         if (call_graph.root().edges_size() == 0)
         {
             // First run, let it run to get something
             current_vertex = nullptr;
         }
-        else if (call_graph.root().value == 0)
+        else if (call_graph.root().value != 0)
+        {
+            if (targeted_replay)
+                plan_target();
+        }
+        else
         {
             log(L">> Exhausted options for systematic driver <<");
             if (auto event_handle = OpenEvent(EVENT_ALL_ACCESS, false, L"SystematicDriverExhaustedEvent"))
@@ -160,10 +280,21 @@ public:
         return true;
     }
 
+    void on_trace_recorded() override
+    {
+        if (frontier)
+            frontier->finish();
+    }
+
 private:
     template<std::ranges::range ThreadInfosRange>
     thread_info* single_thread_to_run(ThreadInfosRange&& thread_infos, const trace& trace)
     {
+        // Frozen threads are not released while waiting, only a newly frozen one can change the decision
+        if (resync_deadline && is_waiting_for_target(thread_infos))
+            return nullptr;
+
+        decision_claims.reset();
         log(L"-- Selecting next thread --");
         log(L"  Options:");
         for (auto* thr_info : thread_infos | views::only_frozen)
@@ -180,7 +311,64 @@ private:
                 log(line);
             }
 
-        auto* thr_info = single_thread_to_run_impl(std::forward<ThreadInfosRange>(thread_infos), trace);
+        // Asleep threads run only to finish their explored subtree (see is_skipped_asleep) or if every frozen thread is asleep,
+        // the stored trace marks the skipped ones (see past_trace_item::asleep)
+        std::pmr::vector<thread_info*> candidates(get_memory_resource());
+        std::size_t asleep = 0;
+        asleep_threads = 0;
+        for (thread_info* frozen : thread_infos | views::only_frozen)
+        {
+            if (!sleep_sets || !is_skipped_asleep(*frozen))
+                candidates.push_back(frozen);
+            else
+            {
+                ++asleep;
+                if (std::size_t counted_id = frozen->get_thread_id().counted_id; counted_id < dpor::MAX_THREADS)
+                    asleep_threads |= std::uint64_t{ 1 } << counted_id;
+            }
+        }
+        if (candidates.empty())
+        {
+            std::ranges::copy(thread_infos | views::only_frozen, std::back_inserter(candidates));
+            asleep = 0;
+            asleep_threads = 0;
+        }
+        if (asleep > 0)
+            log(L"  Asleep: ", asleep);
+
+        // The bound does not change options of the stored trace, values of the next runs are computed for their bound
+        thread_info* last = nullptr;
+        for (thread_info* frozen : thread_infos | views::only_frozen)
+        {
+            if (frozen->get_thread_id().counted_id == last_counted_id)
+                last = frozen;
+        }
+        if (preemption_bounding && last && must_continue(*last))
+            candidates = { last };
+
+        const auto* decision_vertex = current_vertex;
+        auto target_thr_info = follow_target(thread_infos, candidates);
+        if (target_thr_info && !*target_thr_info)
+        {
+            waiting_frozen = static_cast<std::size_t>(std::ranges::distance(thread_infos | views::only_frozen));
+            log(L"  Result: Waiting for the thread of the target");
+            return nullptr;
+        }
+
+        auto* thr_info = target_thr_info ? *target_thr_info : single_thread_to_run_impl(candidates);
+        if (targeted_replay && !has_target && decision_vertex && current_vertex && current_vertex->value != 0)
+            plan_target();
+        if (sleep_sets)
+            update_sleep_set(decision_vertex, thread_infos, *thr_info);
+        if (last && last != thr_info)
+        {
+            ++preemptions;
+            log(L"  Preemptions: ", preemptions);
+        }
+        last_counted_id = thr_info->get_thread_id().counted_id;
+        if (frontier && decision_vertex)
+            frontier->extend(claim_key(*thr_info));
+
         log(L"  Updated vertex: ", format_vertex(current_vertex));
         log(L"  Result: ", format_thread_info(thr_info));
         extra_log << std::endl;
@@ -203,14 +391,25 @@ private:
         return value;
     }
 
-    template<std::ranges::range ThreadInfosRange>
-    thread_info* single_thread_to_run_impl(ThreadInfosRange&& thread_infos, const trace& trace)
+    thread_info* single_thread_to_run_impl(const std::pmr::vector<thread_info*>& candidates)
     {
         if (!current_vertex)
         {
             // unexplored path, pick one
             log(L"  Reason: No current vertex");
-            return select_value(thread_infos | views::only_frozen);
+            return select_value(candidates);
+        }
+
+        // edge matched by every frozen thread (edges_size if none), edges of a vertex differ so there is at most one
+        index_current_edges();
+        std::pmr::vector<std::pair<thread_info*, std::size_t>> matches(get_memory_resource());
+        for (thread_info* thr_info : candidates)
+            matches.emplace_back(thr_info, find_matching_edge(*thr_info));
+
+        if (frontier && frontier->depth() < frontier_board::MAX_PREFIX)
+        {
+            if (auto* thr_info = select_unclaimed(matches))
+                return thr_info;
         }
 
         // get all nonexhausted vertices
@@ -222,45 +421,51 @@ private:
         if (!indices.empty())
         {
             std::size_t random_index = select_value(indices);
-            const auto& edge = current_vertex->get_edge(random_index);
-            for (thread_info* thr_info : thread_infos | views::only_frozen)
+            if (auto match = std::ranges::find(matches, random_index, &std::pair<thread_info*, std::size_t>::second); match != matches.end())
             {
-                if (trace_matches_edge(*thr_info, edge))
-                {
-                    current_vertex = &current_vertex->next_vertex(random_index);
-                    std::pmr::wstring line(get_memory_resource());
-                    std::format_to(std::back_inserter(line), L"  Reason: Random nonexhausted vertex, matched edge [{}]", random_index);
-                    log(line);
-                    return thr_info;
-                }
+                current_vertex = &current_vertex->next_vertex(random_index);
+                std::pmr::wstring line(get_memory_resource());
+                std::format_to(std::back_inserter(line), L"  Reason: Random nonexhausted vertex, matched edge [{}]", random_index);
+                log(line);
+                return match->first;
             }
         }
 
         // try to pick non-explored, but previously seen path first
-        std::size_t index = get_next_nonexhausted_vertex_index(0);
-        while (index < current_vertex->edges_size())
+        auto first_nonexhausted = matches.end();
+        for (auto match = matches.begin(); match != matches.end(); ++match)
+        {
+            if (match->second < current_vertex->edges_size() && current_vertex->next_vertex(match->second).value != 0
+                && (first_nonexhausted == matches.end() || match->second < first_nonexhausted->second))
+                first_nonexhausted = match;
+        }
+        if (first_nonexhausted != matches.end())
         {
-            const auto& edge = current_vertex->get_edge(index);
-            for (thread_info* thr_info : thread_infos | views::only_frozen)
+            current_vertex = &current_vertex->next_vertex(first_nonexhausted->second);
+            std::pmr::wstring line(get_memory_resource());
+            std::format_to(std::back_inserter(line), L"  Reason: Iterating over non-exhausted vertex, matched edge [{}]", first_nonexhausted->second);
+            log(line);
+            return first_nonexhausted->first;
+        }
+
+        // None direct continuation, select new one that doesn't match
+        // Options count only the threads of the backtrack sets and not the asleep ones, so these go first
+        if (partial_order_reduction || sleep_sets)
+        {
+            for (auto [thr_info, index] : matches)
             {
-                if (trace_matches_edge(*thr_info, edge))
+                if (index == current_vertex->edges_size() && is_unexplored_option(*thr_info, matches))
                 {
-                    current_vertex = &current_vertex->next_vertex(index);
-                    std::pmr::wstring line(get_memory_resource());
-                    std::format_to(std::back_inserter(line), L"  Reason: Iterating over non-exhausted vertex, matched edge [{}]", index);
-                    log(line);
+                    current_vertex = nullptr;
+                    log(L"  Reason: Fallback, exploring new path of the backtrack set");
                     return thr_info;
                 }
             }
-
-            // Not in this edge, pick next
-            index = get_next_nonexhausted_vertex_index(index + 1);
         }
 
-        // None direct continuation, select new one that doesn't match
-        for (thread_info* thr_info : thread_infos | views::only_frozen)
+        for (auto [thr_info, index] : matches)
         {
-            if (!thr_info_matches_any_edge(*thr_info))
+            if (index == current_vertex->edges_size())
             {
                 current_vertex = nullptr;
                 log(L"  Reason: Fallback, exploring new path");
@@ -272,34 +477,368 @@ private:
         current_vertex = nullptr;
 
         log(L"  Reason: Unknown area, what happened?");
-        return (thread_infos | views::only_frozen).front();
+        return candidates.front();
     }
 
-    [[nodiscard]] bool trace_matches_edge(const thread_info& thr_info, const past_trace_item& item) const
+    /// <summary>
+    /// Returns true if the previous thread has to continue: the run reached the bound, or the continuation was not explored yet
+    /// (non-preemptive schedules go first, and the call graph learns that the thread could continue).
+    /// </summary>
+    [[nodiscard]] bool must_continue(const thread_info& last)
     {
-        return item.counted_id == thr_info.get_thread_id().counted_id
-            && item.function_id.compare(thr_info.call_stack->back()->get_pretty_info(get_memory_resource())) == 0 // NOLINT(readability-string-compare)
-            ;
+        if (preemptions >= preemption_bound || !current_vertex)
+            return true;
+
+        index_current_edges();
+        return find_matching_edge(last) == current_vertex->edges_size();
     }
 
-    [[nodiscard]] std::size_t get_next_nonexhausted_vertex_index(std::size_t start_index) const
+    /// <summary>
+    /// Computes values of the call graph for the bound of the data file, raises the bound while everything within it is explored.
+    /// </summary>
+    void update_preemption_bound(const std::wstring& data_file_path)
     {
-        for (std::size_t i = start_index; i < current_vertex->edges_size(); ++i)
+        preemption_bound = preemption_bounding::read_bound(data_file_path);
+        std::size_t stored_bound = preemption_bound;
+
+        bool frontier = preemption_bounding::compute_values(call_graph, preemption_bound);
+        while (call_graph.root().edges_size() > 0 && call_graph.root().value == 0 && frontier)
+            frontier = preemption_bounding::compute_values(call_graph, ++preemption_bound);
+
+        if (preemption_bound != stored_bound || call_graph.root().edges_size() == 0)
+            preemption_bounding::write_bound(data_file_path, preemption_bound);
+        log(L"Preemption bound ", preemption_bound, L" (", call_graph.root().value, L" options left)");
+    }
+
+    /// <summary>
+    /// Chooses the target below the current vertex: goes down the nonexhausted edges (by search_type) and stops at a vertex
+    /// with unexplored options, the run replays the edges to it and explores a new path there.
+    /// </summary>
+    void plan_target()
+    {
+        target_path.clear();
+        target_depth = 0;
+        resync_deadline.reset();
+
+        std::pmr::vector<std::size_t> indices(get_memory_resource());
+        for (const auto* vertex = current_vertex;;)
         {
-            if (current_vertex->next_vertex(i).value != 0)
-                return i;
+            // Unexplored options of the vertex (as counted by its value, i.e. by the pruner or the preemption bound)
+            int unexplored = vertex->value;
+            indices.clear();
+            for (std::size_t i = 0; i < vertex->edges_size(); ++i)
+            {
+                unexplored -= vertex->next_vertex(i).value;
+                if (vertex->next_vertex(i).value != 0)
+                    indices.push_back(i);
+            }
+            if (unexplored > 0)
+                indices.push_back(vertex->edges_size());
+
+            std::size_t index = indices.empty() ? vertex->edges_size() : select_value(indices);
+            if (index == vertex->edges_size())
+                break;
+
+            target_path.push_back(index);
+            vertex = &vertex->next_vertex(index);
         }
-        return current_vertex->edges_size();
+
+        has_target = true;
+        log(L"  Target: ", target_path.size(), L" edges below ", format_vertex(current_vertex));
     }
 
-    [[nodiscard]] bool thr_info_matches_any_edge(const thread_info& thr_info) const
+    /// <summary>
+    /// Takes the next edge to the target, or a new edge of an unexplored option (see is_unexplored_option) at the target.
+    /// If the thread of the edge is still running to its stop point (the threads drifted from the explored run),
+    /// returns nullptr until it is frozen or RESYNC_TIMEOUT passes.
+    /// Returns nullopt if there is no target or it was lost, the next vertex chooses a new one.
+    /// </summary>
+    template<std::ranges::range ThreadInfosRange>
+    std::optional<thread_info*> follow_target(ThreadInfosRange&& thread_infos, const std::pmr::vector<thread_info*>& candidates)
     {
+        if (!has_target || !current_vertex)
+            return std::nullopt;
+
+        index_current_edges();
+        bool target_reached = target_depth == target_path.size();
+        std::size_t index = target_reached ? current_vertex->edges_size() : target_path[target_depth];
+
+        // With the reductions, a new edge at the target explores it only for an awake thread of the backtrack set
+        std::pmr::vector<std::pair<thread_info*, std::size_t>> matches(get_memory_resource());
+        if (target_reached && (partial_order_reduction || sleep_sets))
+        {
+            for (thread_info* thr_info : candidates)
+                matches.emplace_back(thr_info, find_matching_edge(*thr_info));
+        }
+
+        for (thread_info* thr_info : candidates)
+        {
+            if (find_matching_edge(*thr_info) != index || (target_reached && !is_unexplored_option(*thr_info, matches)))
+                continue;
+
+            if (!target_reached && is_claimed_by_others(index))
+                break;
+
+            resync_deadline.reset();
+            std::pmr::wstring line(get_memory_resource());
+            if (target_reached)
+            {
+                has_target = false;
+                current_vertex = nullptr;
+                line += L"  Reason: Target reached, exploring new path";
+            }
+            else
+            {
+                ++target_depth;
+                current_vertex = &current_vertex->next_vertex(index);
+                std::format_to(std::back_inserter(line), L"  Reason: Replaying target, edge [{}] ({}/{})", index, target_depth, target_path.size());
+            }
+            log(line);
+            return thr_info;
+        }
+
+        auto now = std::chrono::steady_clock::now();
+        if (!resync_deadline)
+            resync_deadline = now + RESYNC_TIMEOUT;
+        if (now < *resync_deadline && is_target_thread_running(thread_infos))
+            return nullptr;
+
+        log(L"  Target lost, resynchronizing");
+        has_target = false;
+        resync_deadline.reset();
+        return std::nullopt;
+    }
+
+    /// <summary>
+    /// Returns true if the thread of the next edge to the target (any thread at the target) may be on its way to the stop point.
+    /// </summary>
+    template<std::ranges::range ThreadInfosRange>
+    [[nodiscard]] bool is_target_thread_running(ThreadInfosRange&& thread_infos) const
+    {
+        bool target_reached = target_depth == target_path.size();
+        return std::ranges::any_of(thread_infos, [this, target_reached](const thread_info* thr_info)
+        {
+            return !thr_info->is_frozen() && (target_reached || thr_info->get_thread_id().counted_id == current_vertex->get_edge(target_path[target_depth]).counted_id);
+        });
+    }
+
+    /// <summary>
+    /// Returns true if the decision which started waiting for the thread of the target (see follow_target) still waits:
+    /// no thread was frozen since and the thread of the target is still running before RESYNC_TIMEOUT.
+    /// </summary>
+    template<std::ranges::range ThreadInfosRange>
+    [[nodiscard]] bool is_waiting_for_target(ThreadInfosRange&& thread_infos) const
+    {
+        return static_cast<std::size_t>(std::ranges::distance(thread_infos | views::only_frozen)) == waiting_frozen
+            && std::chrono::steady_clock::now() < *resync_deadline && is_target_thread_running(thread_infos);
+    }
+
+    [[nodiscard]] bool is_claimed_by_others(std::size_t index)
+    {
+        if (!frontier || frontier->depth() == frontier_board::MAX_PREFIX)
+            return false;
+
+        const auto& claims = get_claims();
+        auto claim = claims.find(claim_key(current_vertex->get_edge(index)));
+        return claim != claims.end() && current_vertex->next_vertex(index).value <= static_cast<int>(claim->second);
+    }
+
+    /// <summary>
+    /// Selects a thread leading to work not claimed by the other workers, nullptr if there is none (the work is shared then).
+    /// </summary>
+    thread_info* select_unclaimed(const std::pmr::vector<std::pair<thread_info*, std::size_t>>& matches)
+    {
+        const auto& claims = get_claims();
+        if (claims.empty())
+            return nullptr;
+
+        auto claimed = [&claims](std::uint64_t key)
+        {
+            auto iter = claims.find(key);
+            return iter != claims.end() ? iter->second : 0;
+        };
+
+        // Claims not on the edges of the vertex take its unexplored options
+        std::size_t new_path_claims = 0;
+        for (auto [key, count] : claims)
+            new_path_claims += count;
+        for (std::size_t i = 0; i < current_vertex->edges_size(); ++i)
+            new_path_claims -= claimed(claim_key(current_vertex->get_edge(i)));
+
+        std::pmr::vector<std::pair<thread_info*, std::size_t>> unclaimed(get_memory_resource());
+        for (auto match : matches)
+        {
+            if (match.second < current_vertex->edges_size()
+                && current_vertex->next_vertex(match.second).value > static_cast<int>(claimed(claim_key(current_vertex->get_edge(match.second)))))
+                unclaimed.push_back(match);
+        }
+        if (!unclaimed.empty())
+        {
+            auto [thr_info, index] = select_value(unclaimed);
+            current_vertex = &current_vertex->next_vertex(index);
+            std::pmr::wstring line(get_memory_resource());
+            std::format_to(std::back_inserter(line), L"  Reason: Work not claimed by other workers, matched edge [{}]", index);
+            log(line);
+            return thr_info;
+        }
+
+        if (call_graph_utils::unexplored_options(*current_vertex) > static_cast<int>(new_path_claims))
+        {
+            for (auto [thr_info, index] : matches)
+            {
+                if (index == current_vertex->edges_size() && claimed(claim_key(*thr_info)) == 0 && is_unexplored_option(*thr_info, matches))
+                {
+                    current_vertex = nullptr;
+                    log(L"  Reason: Fallback, exploring new path not claimed by other workers");
+                    return thr_info;
+                }
+            }
+        }
+
+        log(L"  Claimed by other workers: ", claims.size(), L" edges, sharing their work");
+        return nullptr;
+    }
+
+    /// <summary>
+    /// Returns claims of the other workers next to the current decision, read from the board by the first call of the decision.
+    /// </summary>
+    const std::pmr::unordered_map<std::uint64_t, std::size_t>& get_claims()
+    {
+        if (!decision_claims)
+            decision_claims = frontier->next_claims(get_memory_resource());
+        return *decision_claims;
+    }
+
+    std::uint64_t claim_key(std::size_t counted_id, function_table::key_t function_key)
+    {
+        auto [iter, inserted] = function_hashes.try_emplace(function_key, 0);
+        if (inserted)
+            iter->second = frontier_board::function_hash(function_table::get_instance().get(function_key));
+        return frontier_board::edge_key(counted_id, iter->second);
+    }
+
+    std::uint64_t claim_key(const past_trace_item& edge)
+    {
+        return claim_key(edge.counted_id, edge.function_key);
+    }
+
+    std::uint64_t claim_key(const thread_info& thr_info)
+    {
+        return claim_key(thr_info.get_thread_id().counted_id, function_table::get_instance().intern(thr_info.call_stack->back()));
+    }
+
+    [[nodiscard]] bool is_asleep(const thread_info& thr_info) const
+    {
+        auto function_key = function_table::get_instance().intern(thr_info.call_stack->back());
+        return std::ranges::any_of(sleep_set, [&thr_info, function_key](const sleeping_step& step)
+        {
+            return step.counted_id == thr_info.get_thread_id().counted_id && step.function_key == function_key && step.object == thr_info.current_object();
+        });
+    }
+
+    /// <summary>
+    /// Returns true if the step of the thread is asleep and has no edge with unexplored options at the current vertex.
+    /// The subtree of the edge was explored before the step fell asleep, its value counts in the vertex, so it is finished.
+    /// </summary>
+    [[nodiscard]] bool is_skipped_asleep(const thread_info& thr_info)
+    {
+        if (!is_asleep(thr_info))
+            return false;
+        if (!current_vertex)
+            return true;
+
+        index_current_edges();
+        std::size_t index = find_matching_edge(thr_info);
+        return index == current_vertex->edges_size() || current_vertex->next_vertex(index).value == 0;
+    }
+
+    /// <summary>
+    /// Steps of the exhausted siblings of the chosen edge fall asleep, sleeping steps dependent with the chosen one wake up.
+    /// Only collapsed subtrees and leaves are exhausted for sure, values are also zeroed by the preemption bound and the pruner.
+    /// </summary>
+    template<std::ranges::range ThreadInfosRange>
+    void update_sleep_set(const decltype(current_vertex) vertex, ThreadInfosRange&& thread_infos, const thread_info& chosen)
+    {
+        if (vertex)
+        {
+            for (thread_info* frozen : thread_infos | views::only_frozen)
+            {
+                past_trace_item key{ frozen->get_thread_id().counted_id, function_table::get_instance().intern(frozen->call_stack->back()), 0 };
+                auto edge = current_edges.find(key);
+                if (frozen == &chosen || edge == current_edges.end() || is_asleep(*frozen))
+                    continue;
+
+                const auto& sibling = vertex->next_vertex(edge->second);
+                if (sibling.is_collapsed() || sibling.edges_size() == 0)
+                    sleep_set.push_back({ key.counted_id, key.function_key, frozen->current_object() });
+            }
+        }
+
+        std::erase_if(sleep_set, [&chosen](const sleeping_step& step)
+        {
+            return step.counted_id == chosen.get_thread_id().counted_id || dpor::are_dependent(step.object, chosen.current_object());
+        });
+    }
+
+    void index_current_edges()
+    {
+        if (indexed_vertex == current_vertex)
+            return;
+
+        current_edges.clear();
         for (std::size_t i = 0; i < current_vertex->edges_size(); ++i)
+            current_edges.emplace(current_vertex->get_edge(i), i);
+        indexed_vertex = current_vertex;
+    }
+
+    /// <summary>
+    /// Returns index of the edge of the current vertex the thread would take, edges_size if there is none.
+    /// Function keys are interned, so it is a single hash probe.
+    /// </summary>
+    [[nodiscard]] std::size_t find_matching_edge(const thread_info& thr_info) const
+    {
+        past_trace_item key{ thr_info.get_thread_id().counted_id, function_table::get_instance().intern(thr_info.call_stack->back()), 0 };
+        auto iter = current_edges.find(key);
+        return iter != current_edges.end() ? iter->second : current_vertex->edges_size();
+    }
+
+    /// <summary>
+    /// Returns true if a new path of the thread explores an option counted by the current vertex (see call_graph_utils::unexplored_options).
+    /// Threads asleep at the vertex in some stored run are not. With the reduction these are the threads of the backtrack sets
+    /// merged at the vertex, threads dependent with explored ones if the sets are not known.
+    /// </summary>
+    [[nodiscard]] bool is_unexplored_option(const thread_info& thr_info, const std::pmr::vector<std::pair<thread_info*, std::size_t>>& matches) const
+    {
+        std::size_t counted_id = thr_info.get_thread_id().counted_id;
+        std::uint64_t thread_bit = counted_id < dpor::MAX_THREADS ? std::uint64_t{ 1 } << counted_id : 0;
+        if ((call_graph_utils::asleep_mask(*current_vertex) & thread_bit) != 0)
+            return false;
+
+        if (!partial_order_reduction)
+            return true;
+
+        std::uint64_t backtrack = call_graph_utils::backtrack_mask(*current_vertex);
+        if (backtrack == 0)
+            return is_dependent_with_explored(thr_info, matches);
+
+        return (backtrack & thread_bit) != 0;
+    }
+
+    [[nodiscard]] bool is_dependent_with_explored(const thread_info& thr_info, const std::pmr::vector<std::pair<thread_info*, std::size_t>>& matches) const
+    {
+        return std::ranges::any_of(matches, [this, &thr_info](const auto& match)
+        {
+            return match.second < current_vertex->edges_size() && dpor::are_dependent(thr_info.current_object(), match.first->current_object());
+        });
+    }
+
+    [[nodiscard]] std::size_t get_next_nonexhausted_vertex_index(std::size_t start_index) const
+    {
+        for (std::size_t i = start_index; i < current_vertex->edges_size(); ++i)
         {
-            const auto& edge = current_vertex->get_edge(i);
-            if (trace_matches_edge(thr_info, edge))
-                return true;
+            if (current_vertex->next_vertex(i).value != 0)
+                return i;
         }
-        return false;
+        return current_vertex->edges_size();
     }
 };
@@ -0,0 +1,311 @@
+#pragma once
+
+#include "../cor_error_handling.hpp"
+#include "../utils/hash_combine.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <format>
+#include <functional>
+#include <memory_resource>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+#include <Windows.h>
+
+/// <summary>
+/// Board shared by systematic workers exploring the same data file at the same time (see trace_store segments).
+///
+/// Every worker claims a slot and publishes the prefix of its run: the edges it took while it followed the call graph,
+/// ending with the first edge that left it. Other workers read the claims at their decisions, a subtree with claims
+/// through it has less unexplored work left for them, so they spread over the graph instead of running the same path.
+/// Once no work is free, a worker shares a claimed subtree (steals a part of it), as its unexplored options are more than
+/// a single run explores.
+///
+/// A claim is kept after its trace is recorded, until every worker that loaded the call graph before that knows the trace.
+/// Claims of processes that ended without recording their trace are dropped when a slot is taken.
+///
+/// Named shared memory 'Local\ThreadFuzzerFrontier.(hash of data_file)', guarded by a named mutex of the same suffix.
+/// Edges are identified by a hash of their counted id and function id, so they are the same in every process.
+/// </summary>
+class frontier_board
+{
+public:
+    static constexpr std::uint32_t BOARD_VERSION = 2;
+    static constexpr std::size_t MAX_WORKERS = 64;
+    static constexpr std::size_t MAX_PREFIX = 4096; // longer prefixes are claimed up to here
+
+private:
+    enum class slot_state : std::uint32_t
+    {
+        FREE,
+        ACTIVE,
+        FINISHED,
+    };
+
+    struct board_slot
+    {
+        std::uint32_t process_id;
+        slot_state state;
+        std::uint64_t generation; // changes when the slot is taken, see claim_cache
+        std::uint64_t start_sequence; // sequence when the worker started loading the call graph
+        std::uint64_t finish_sequence; // sequence when the worker recorded its trace
+        std::uint32_t length;
+        std::uint64_t prefix[MAX_PREFIX];
+    };
+
+    struct board_header
+    {
+        std::uint32_t version;
+        std::uint64_t sequence; // incremented by every recorded trace
+        board_slot slots[MAX_WORKERS];
+    };
+
+    // How far the claim of a slot was found to follow the prefix of this worker
+    struct claim_cache
+    {
+        std::uint64_t generation;
+        std::uint32_t checked;
+        bool diverged;
+    };
+
+    HANDLE mutex_handle;
+    HANDLE mapping_handle;
+    board_header* board;
+    board_slot* own_slot;
+    std::uint64_t start_sequence;
+    std::array<claim_cache, MAX_WORKERS> caches;
+
+    class board_lock
+    {
+        HANDLE mutex_handle;
+
+    public:
+        explicit board_lock(HANDLE mutex_handle) : mutex_handle(mutex_handle)
+        {
+            // Abandoned mutex (owner crashed) is acquired as well, slots are never left half-written
+            WaitForSingleObject(mutex_handle, INFINITE);
+        }
+
+        board_lock(const board_lock&) = delete;
+        board_lock& operator=(const board_lock&) = delete;
+
+        ~board_lock()
+        {
+            ReleaseMutex(mutex_handle);
+        }
+    };
+
+public:
+    /// <summary>
+    /// Opens the board of the data file and claims a slot, must be called before the call graph is loaded.
+    /// </summary>
+    explicit frontier_board(const std::wstring& data_file_path)
+        : mutex_handle(nullptr), mapping_handle(nullptr), board(nullptr), own_slot(nullptr), start_sequence(0), caches{}
+    {
+        auto suffix = std::format(L"{:x}", std::hash<std::wstring>{}(std::filesystem::absolute(data_file_path).wstring()));
+
+        mutex_handle = CreateMutex(nullptr, false, (L"Local\\ThreadFuzzerFrontierLock." + suffix).c_str());
+        if (!mutex_handle)
+            throw profiler_error(L"Cannot create frontier board lock");
+
+        mapping_handle = CreateFileMapping(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE, 0, static_cast<DWORD>(sizeof(board_header)), (L"Local\\ThreadFuzzerFrontier." + suffix).c_str());
+        if (!mapping_handle)
+        {
+            CloseHandle(mutex_handle);
+            throw profiler_error(L"Cannot create frontier board");
+        }
+
+        board = static_cast<board_header*>(MapViewOfFile(mapping_handle, FILE_MAP_ALL_ACCESS, 0, 0, sizeof(board_header)));
+        if (!board)
+        {
+            CloseHandle(mapping_handle);
+            CloseHandle(mutex_handle);
+            throw profiler_error(L"Cannot map frontier board");
+        }
+
+        bool supported;
+        {
+            board_lock lock(mutex_handle);
+            if (board->version == 0) // new mapping is zeroed
+                board->version = BOARD_VERSION;
+
+            supported = board->version == BOARD_VERSION;
+            if (supported)
+            {
+                start_sequence = board->sequence;
+                own_slot = take_slot();
+            }
+            if (own_slot)
+            {
+                own_slot->process_id = GetCurrentProcessId();
+                own_slot->state = slot_state::ACTIVE;
+                own_slot->generation += 1;
+                own_slot->start_sequence = start_sequence;
+                own_slot->finish_sequence = 0;
+                own_slot->length = 0;
+            }
+        }
+
+        if (!supported)
+        {
+            UnmapViewOfFile(board);
+            CloseHandle(mapping_handle);
+            CloseHandle(mutex_handle);
+            throw profiler_error(L"Frontier board has unsupported version");
+        }
+    }
+
+    frontier_board(const frontier_board&) = delete;
+    frontier_board& operator=(const frontier_board&) = delete;
+
+    ~frontier_board()
+    {
+        if (own_slot)
+        {
+            board_lock lock(mutex_handle);
+            if (own_slot->state == slot_state::ACTIVE)
+                own_slot->state = slot_state::FREE;
+        }
+        UnmapViewOfFile(board);
+        CloseHandle(mapping_handle);
+        CloseHandle(mutex_handle);
+    }
+
+    /// <summary>
+    /// Returns false if every slot is taken, the worker runs without coordination then.
+    /// </summary>
+    explicit operator bool() const
+    {
+        return own_slot != nullptr;
+    }
+
+    /// <summary>
+    /// Returns the hash of a function id, workers cache it per function (see edge_key).
+    /// </summary>
+    static std::size_t function_hash(std::wstring_view function_id)
+    {
+        return std::hash<std::wstring_view>{}(function_id);
+    }
+
+    /// <summary>
+    /// Returns the key of an edge, the same in every worker.
+    /// </summary>
+    static std::uint64_t edge_key(std::size_t counted_id, std::size_t function_hash)
+    {
+        return tmt::hash_combine(counted_id, function_hash);
+    }
+
+    /// <summary>
+    /// Returns number of edges claimed by this worker.
+    /// </summary>
+    [[nodiscard]] std::size_t depth() const
+    {
+        return own_slot ? own_slot->length : 0;
+    }
+
+    /// <summary>
+    /// Appends the edge taken by this worker to its claim.
+    /// </summary>
+    void extend(std::uint64_t key)
+    {
+        if (!own_slot || own_slot->length == MAX_PREFIX)
+            return;
+
+        board_lock lock(mutex_handle);
+        own_slot->prefix[own_slot->length] = key;
+        own_slot->length += 1;
+    }
+
+    /// <summary>
+    /// Marks the trace of this worker as recorded in the data file.
+    /// </summary>
+    void finish()
+    {
+        if (!own_slot)
+            return;
+
+        board_lock lock(mutex_handle);
+        own_slot->state = slot_state::FINISHED;
+        own_slot->finish_sequence = ++board->sequence;
+    }
+
+    /// <summary>
+    /// Returns the keys of the next edges claimed by the other workers whose claims follow the claim of this worker,
+    /// with the number of workers claiming each of them.
+    /// </summary>
+    std::pmr::unordered_map<std::uint64_t, std::size_t> next_claims(std::pmr::memory_resource* mem_res)
+    {
+        std::pmr::unordered_map<std::uint64_t, std::size_t> claims(mem_res);
+        if (!own_slot)
+            return claims;
+
+        board_lock lock(mutex_handle);
+        std::uint32_t length = own_slot->length;
+        for (std::size_t i = 0; i < MAX_WORKERS; ++i)
+        {
+            const board_slot& slot = board->slots[i];
+            if (&slot == own_slot || !is_claimed(slot) || slot.length <= length)
+                continue;
+
+            claim_cache& cache = caches[i];
+            if (cache.generation != slot.generation)
+                cache = { slot.generation, 0, false };
+
+            // Claims only grow while their slot is taken, the checked part stays the same
+            for (; cache.checked < length && !cache.diverged; ++cache.checked)
+                cache.diverged = slot.prefix[cache.checked] != own_slot->prefix[cache.checked];
+
+            if (!cache.diverged)
+                claims[slot.prefix[length]] += 1;
+        }
+        return claims;
+    }
+
+private:
+    [[nodiscard]] bool is_claimed(const board_slot& slot) const
+    {
+        // Traces recorded after this worker started loading the call graph are not in its call graph
+        return slot.state == slot_state::ACTIVE || (slot.state == slot_state::FINISHED && slot.finish_sequence > start_sequence);
+    }
+
+    static bool is_process_running(std::uint32_t process_id)
+    {
+        HANDLE process = OpenProcess(SYNCHRONIZE, false, process_id);
+        if (!process)
+            return false;
+
+        bool running = WaitForSingleObject(process, 0) == WAIT_TIMEOUT;
+        CloseHandle(process);
+        return running;
+    }
+
+    board_slot* take_slot()
+    {
+        // Finished claim is needed while some running worker started before the trace was recorded
+        std::uint64_t oldest_start = start_sequence;
+        for (board_slot& slot : board->slots)
+        {
+            if (slot.state == slot_state::ACTIVE && !is_process_running(slot.process_id))
+                slot.state = slot_state::FREE;
+            if (slot.state == slot_state::ACTIVE)
+                oldest_start = std::min(oldest_start, slot.start_sequence);
+        }
+
+        for (board_slot& slot : board->slots)
+        {
+            if (slot.state == slot_state::FREE)
+                return &slot;
+        }
+        for (board_slot& slot : board->slots)
+        {
+            if (slot.state == slot_state::FINISHED && slot.finish_sequence <= oldest_start)
+                return &slot;
+        }
+        return nullptr;
+    }
+};
@@ -0,0 +1,116 @@
+#pragma once
+
+#include "../net_types.hpp"
+#include "../cor_error_handling.hpp"
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+/// <summary>
+/// Interning table of function ids (<see cref="function_spec::get_pretty_info"/>) shared by the process.
+/// Trace items and call graph edges refer to functions by their key, so matching an edge is an integer compare,
+/// strings are needed only to store traces and to print them.
+/// Keys are valid only within the process, data files and snapshots store the strings.
+///
+/// Thread controller interns every function before it gets on a call stack (see thread_controller::method_entry), so the
+/// decision loop finds keys cached on the function_spec and reads function ids without locking or allocating: application
+/// threads frozen by stop_type=immediate might hold the heap lock or be suspended inside intern.
+/// </summary>
+class function_table
+{
+public:
+    using key_t = std::uint32_t;
+
+    /// <summary>
+    /// Key of the empty function id, e.g. of default constructed items.
+    /// </summary>
+    static constexpr key_t EMPTY_KEY = 0;
+
+private:
+    static constexpr std::size_t CHUNK_SIZE = 1024;
+    static constexpr std::size_t MAX_CHUNKS = 4096;
+
+    mutable std::shared_mutex mtx;
+
+    // Chunks never move and are published before any of their keys, keys view them
+    std::array<std::atomic<std::wstring*>, MAX_CHUNKS> chunks;
+    std::size_t function_ids_size;
+    std::unordered_map<std::wstring_view, key_t> keys;
+
+    function_table()
+        : chunks{}, function_ids_size(0)
+    {
+        intern(std::wstring_view());
+    }
+
+    ~function_table()
+    {
+        for (auto& chunk : chunks)
+            delete[] chunk.load();
+    }
+
+public:
+    function_table(const function_table&) = delete;
+    function_table& operator=(const function_table&) = delete;
+
+    static function_table& get_instance()
+    {
+        static function_table instance;
+        return instance;
+    }
+
+    key_t intern(std::wstring_view function_id)
+    {
+        {
+            std::shared_lock lock(mtx);
+            if (auto iter = keys.find(function_id); iter != keys.end())
+                return iter->second;
+        }
+
+        std::unique_lock lock(mtx);
+        if (auto iter = keys.find(function_id); iter != keys.end())
+            return iter->second;
+
+        auto key = static_cast<key_t>(function_ids_size);
+        if (key / CHUNK_SIZE == MAX_CHUNKS)
+            throw profiler_error(L"Too many functions in function_table");
+
+        auto& chunk = chunks[key / CHUNK_SIZE];
+        if (!chunk.load(std::memory_order_relaxed))
+            chunk.store(new std::wstring[CHUNK_SIZE], std::memory_order_release);
+
+        std::wstring& stored = chunk.load(std::memory_order_relaxed)[key % CHUNK_SIZE];
+        stored = function_id;
+        keys.emplace(stored, key);
+        ++function_ids_size;
+        return key;
+    }
+
+    /// <summary>
+    /// Returns key of the pretty info of the function, cached on the function after the first call.
+    /// Only the first call builds the pretty info and takes the lock.
+    /// </summary>
+    key_t intern(const function_spec* function)
+    {
+        if (key_t key = function->get_function_key(); key != EMPTY_KEY)
+            return key;
+
+        key_t key = intern(function->get_pretty_info());
+        function->set_function_key(key);
+        return key;
+    }
+
+    /// <summary>
+    /// Returns function id of the key, the view is valid as long as the process lives. Does not lock.
+    /// </summary>
+    [[nodiscard]] std::wstring_view get(key_t key) const
+    {
+        return chunks[key / CHUNK_SIZE].load(std::memory_order_acquire)[key % CHUNK_SIZE];
+    }
+};
@@ -0,0 +1,114 @@
+#pragma once
+
+#include "trace.hpp"
+
+#include "../utils/tree_graph.hpp"
+#include "../utils/tree_traversal.hpp"
+
+#include <algorithm>
+#include <cstddef>
+#include <fstream>
+#include <string>
+#include <vector>
+
+/// <summary>
+/// Iterative preemption bounding (CHESS): all schedules with at most bound preemptions are explored before the bound grows.
+///
+/// A preemption is a switch away from the thread of the previous step while it is still frozen (could continue).
+/// Traces keep their options unbounded, values of the call graph are computed for the current bound instead, so vertices
+/// past the bound count as exhausted. A vertex where the bound stops preemptions is on the frontier of the bound, once
+/// everything within the bound is explored, the next bound explores the frontier.
+///
+/// Whether the previous thread was frozen at a vertex is not stored, it is known from the vertex having a child continuing
+/// the previous thread: the driver continues it first whenever it reaches a vertex.
+///
+/// The reached bound is kept in a sidecar file 'data_file.bound', one line per bound, the last one is current.
+/// </summary>
+namespace preemption_bounding
+{
+    inline std::wstring bound_path(const std::wstring& data_file_path)
+    {
+        return data_file_path + L".bound";
+    }
+
+    /// <summary>
+    /// Returns the current bound of the data file, 0 if the search did not start yet.
+    /// </summary>
+    inline std::size_t read_bound(const std::wstring& data_file_path)
+    {
+        std::size_t bound = 0;
+        std::wifstream file(bound_path(data_file_path));
+        for (std::size_t line; file >> line;)
+            bound = line;
+        return bound;
+    }
+
+    inline void write_bound(const std::wstring& data_file_path, std::size_t bound)
+    {
+        std::wofstream file(bound_path(data_file_path), std::ios::app);
+        file << bound << std::endl;
+        if (!file)
+            throw profiler_error(L"Cannot write preemption bound file");
+    }
+
+    /// <summary>
+    /// Computes the values of all vertices for the bound, vertices reached by more preemptions than the bound are exhausted.
+    /// Returns true if the bound hides some edges or options (the frontier is not empty), a greater bound has more to explore.
+    /// </summary>
+    template<typename Alloc>
+    bool compute_values(tree_graph<int, past_trace_item, std::equal_to<>, Alloc>& call_graph, std::size_t bound)
+    {
+        using graph_vertex = typename tree_graph<int, past_trace_item, std::equal_to<>, Alloc>::graph_vertex;
+
+        struct path_vertex
+        {
+            std::size_t preemptions;
+            bool can_continue; // previous thread was frozen at the vertex
+        };
+
+        // Vertices of the current path
+        std::vector<path_vertex> path;
+        bool frontier = false;
+
+        tree_traversal::visit_depth_first(call_graph.root(),
+            [&path](graph_vertex& vertex, std::size_t depth)
+            {
+                std::size_t preemptions = 0;
+                bool can_continue = false;
+                if (depth > 0)
+                {
+                    std::size_t counted_id = vertex.previous_edge().counted_id;
+                    const path_vertex& father = path.back();
+                    bool preempted = father.can_continue && vertex.previous_vertex()->previous_edge().counted_id != counted_id;
+                    preemptions = father.preemptions + (preempted ? 1 : 0);
+
+                    for (std::size_t i = 0; i < vertex.edges_size() && !can_continue; ++i)
+                        can_continue = vertex.get_edge(i).counted_id == counted_id;
+                }
+                path.push_back({ preemptions, can_continue });
+            },
+            [&path, &frontier, bound](graph_vertex& vertex, std::size_t)
+            {
+                auto [preemptions, can_continue] = path.back();
+                path.pop_back();
+
+                if (preemptions > bound)
+                    vertex.value = 0;
+                else if (vertex.edges_size() > 0)
+                {
+                    // Children past the bound are exhausted already, at the bound only the previous thread may continue
+                    bool at_frontier = preemptions == bound && can_continue;
+                    frontier |= at_frontier && (vertex.edges_size() > 1 || call_graph_utils::unexplored_options(vertex) > 0);
+
+                    int current_value = 0;
+                    for (std::size_t j = 0; j < vertex.edges_size(); ++j)
+                        current_value += vertex.next_vertex(j).value;
+                    if (!at_frontier)
+                        current_value += call_graph_utils::unexplored_options(vertex);
+                    vertex.value = current_value;
+                }
+            });
+
+        return frontier;
+    }
+}
@@ -3,8 +3,10 @@
 #include "../trace.hpp"
 
 #include "../../utils/tree_graph.hpp"
+#include "../../utils/tree_traversal.hpp"
 
 #include <iostream>
+#include <vector>
 
 namespace tree_pruners
 {
@@ -19,40 +21,39 @@ namespace tree_pruners
 
         static int randomly_prune_subtree(pmr::tree_graph<int, past_trace_item>::graph_vertex& vertex, std::wofstream& extra_log)
         {
+            // reduced_by_nested of the vertices on the current path, children are pruned before their father
+            std::vector<std::size_t> reduced_by_nested;
             std::size_t reduced_by_total = 0;
-           
-            if (vertex.edges_size() > 0)
-            {
-                std::size_t reduced_by_nested = 0;
 
-                for (std::size_t i = 0; i < vertex.edges_size(); ++i)
+            tree_traversal::visit_depth_first(vertex,
+                [&reduced_by_nested](auto&, std::size_t) { reduced_by_nested.push_back(0); },
+                [&reduced_by_nested, &reduced_by_total](pmr::tree_graph<int, past_trace_item>::graph_vertex& vertex, std::size_t)
                 {
-                    reduced_by_nested += randomly_prune_subtree(vertex.next_vertex(i), extra_log);
-                }
+                    reduced_by_total = reduced_by_nested.back();
+                    reduced_by_nested.pop_back();
 
-                vertex.value -= reduced_by_nested;
+                    vertex.value -= reduced_by_total;
 
-                reduced_by_total += reduced_by_nested;
-            }
+                    if (vertex.value > 0)
+                    {
+                        // here we need to reduce by considering only the number of remaining unexplored threads (choices) at this scheduling point
+                        if (vertex.edges_size() > 0)
+                        {
+                            std::size_t remaining_threads_count = call_graph_utils::unexplored_options(vertex);
 
-            if (vertex.value > 0)
-            {
-                // here we need to reduce by considering only the number of remaining unexplored threads (choices) at this scheduling point
-                // options_size is the same for all edges
+                            std::size_t reduce_for_current = std::rand() % (remaining_threads_count + 1);
 
-                if (vertex.edges_size() > 0)
-                {
-                    std::size_t remaining_threads_count = std::max(0, static_cast<int>(vertex.get_edge(0).options_size - vertex.edges_size()));
+                            vertex.value -= reduce_for_current;
 
-                    std::size_t reduce_for_current = std::rand() % (remaining_threads_count + 1);
+                            reduced_by_total += reduce_for_current;
+                        }
+                    }
 
-                    vertex.value -= reduce_for_current;
+                    // we do not have to modify vertex.options_size here
 
-                    reduced_by_total += reduce_for_current;
-                }
-            }
-             
-            // we do not have to modify vertex.options_size here
+                    if (!reduced_by_nested.empty())
+                        reduced_by_nested.back() += reduced_by_total;
+                });
 
             return reduced_by_total;
         }
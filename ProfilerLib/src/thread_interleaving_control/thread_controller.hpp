@@ -2,7 +2,11 @@
 
 #include "thread_info.hpp"
 #include "stop_points.hpp"
+#include "dpor.hpp"
+#include "function_table.hpp"
 #include "trace.hpp"
+#include "trace_journal.hpp"
+#include "trace_store.hpp"
 #include "atomic_value_exchanger.hpp"
 #include "thread_preemption_bound.hpp"
 
@@ -25,6 +29,7 @@
 #include <memory_resource>
 #include <iostream>
 #include <fstream>
+#include <chrono>
 
 #include <Windows.h>
 
@@ -59,6 +64,11 @@ class thread_controller
     spin_lock spin_lock;
 
     std::optional<Driver> driver;
+    std::optional<trace_journal> journal;
+    std::wstring record_path;
+
+    // Recovery of a journal by another worker takes a moment, waiting longer means a live run uses the same segment
+    static constexpr std::chrono::seconds JOURNAL_CLAIM_TIMEOUT{ 10 };
 
     thread_info* get_thread_info()
     {
@@ -141,12 +151,14 @@ class thread_controller
         }
 
         bool trace_enabled = output;
-        bool data_file_enabled = !config_file::get_instance().get_value(L"data_file").empty() && driver->should_update_data_file();
+        bool data_file_enabled = is_data_file_enabled();
+        bool reduction_enabled = data_file_enabled && is_partial_order_reduction_enabled();
 
         std::chrono::microseconds thawing_timeout(config_file::get_instance().get_value<int>(L"thawing_timeout"));
         auto sleep_func = init_sleep_function(thawing_timeout);
 
         trace trace(memory_resource);
+        bool untracked_threads = false;
         while (is_enabled)
         {
             if (auto [thr_info, raii_release] = thread_info_to_add.load(); thr_info != nullptr)
@@ -180,8 +192,14 @@ class thread_controller
 
                 std::size_t options_size = std::ranges::distance(thread_infos | views::as_thread_info_ptrs | views::only_frozen);
 
+                // Frozen threads are taken before the chosen ones are thawed
+                std::uint64_t frozen_threads = reduction_enabled ? dpor::threads_mask(thread_infos | views::as_thread_info_ptrs | views::only_frozen) : 0;
+                untracked_threads |= reduction_enabled && frozen_threads == 0;
+
                 if (trace_enabled || data_file_enabled)
-                    trace.add(threads, options_size);
+                    trace.add(threads, options_size, frozen_threads, driver->get_asleep_threads());
+                if (journal)
+                    journal->add(threads, options_size, frozen_threads, driver->get_asleep_threads());
 
                 for (thread_info* thr_info : threads)
                 {
@@ -195,8 +213,27 @@ class thread_controller
 
         if (data_file_enabled)
         {
-            trace_file trace_log(config_file::get_instance().get_value(L"data_file"));
-            trace_log.append_trace(trace);
+            journal->finish();
+
+            if (reduction_enabled)
+            {
+                // Logged after the run rather than at the decision, logging allocates
+                if (untracked_threads)
+                    profiler.log<logging_level::WARN>(L"Some decisions had threads with counted id of ", dpor::MAX_THREADS, L" or more, partial order reduction skipped them");
+                dpor::reduce_options(trace, memory_resource);
+            }
+
+            trace_file trace_log(record_path);
+            trace_log.set_deduplication(is_deduplication_enabled(), dedup_segments());
+            if (trace_log.append_trace(trace) == trace_file::append_result::COUNTED)
+                profiler.log<logging_level::INFO>(L"Trace is already stored in the data file, its hit count was increased");
+
+            // Keep the journal for the next run if the trace could not be committed
+            if (trace_log)
+            {
+                journal->remove();
+                driver->on_trace_recorded();
+            }
         }
 
         if (output)
@@ -204,8 +241,9 @@ class thread_controller
             *output << std::endl;
             trace.for_each([output, this](const trace_item& item)
             {
-                *output << item.thr_id.counted_id << L" " << item.function->get_pretty_info(memory_resource) << L" [options: " << item.options_size << L"]" << std::endl;
+                *output << item.thr_id.counted_id << L" " << item.function->get_pretty_info(memory_resource) << L" [options: " << item.options_size << L"]\n";
             });
+            output->flush();
         }
 
         std::this_thread::sleep_for(std::chrono::milliseconds(20));
@@ -219,10 +257,92 @@ class thread_controller
         profiler.log<logging_level::ERROR>(err.wwhat());
     }
 
+    static bool is_data_file_enabled()
+    {
+        return !config_file::get_instance().get_value(L"data_file").empty() && Driver::should_update_data_file();
+    }
+
+    static bool is_deduplication_enabled()
+    {
+        return config_file::get_instance().get_value(L"data_file_dedup") == L"on";
+    }
+
+    /// <summary>
+    /// Returns the other segments of the data file, identical traces recorded by other workers are found in them.
+    /// </summary>
+    std::vector<std::wstring> dedup_segments() const
+    {
+        if (!is_deduplication_enabled())
+            return {};
+        return trace_store::other_segment_paths(config_file::get_instance().get_value(L"data_file"), record_path);
+    }
+
+    static bool is_partial_order_reduction_enabled()
+    {
+        return config_file::get_instance().get_value(L"partial_order_reduction") == L"dpor";
+    }
+
+    /// <summary>
+    /// Selects the data file (or its segment) to record the trace to, commits or discards the trace journals
+    /// left behind by the previous runs and starts a new one. Must happen before the driver reads the data file.
+    /// Journals of the other segments are recovered as well, unless their runs are alive (a worker slot might not run again).
+    /// </summary>
+    void open_trace_journal()
+    {
+        const std::wstring& data_file_path = config_file::get_instance().get_value(L"data_file");
+        record_path = trace_store::record_path(data_file_path);
+        bool keep_partial = config_file::get_instance().get_value(L"partial_traces") != L"discard";
+
+        auto deadline = std::chrono::steady_clock::now() + JOURNAL_CLAIM_TIMEOUT;
+        trace_journal::recovery_result result;
+        while ((result = trace_journal::recover(record_path, keep_partial, is_deduplication_enabled(), dedup_segments())) == trace_journal::recovery_result::IN_USE)
+        {
+            if (std::chrono::steady_clock::now() > deadline)
+                throw profiler_error(L"Trace journal of " + record_path + L" is used by another process, THREADFUZZER_WORKER must differ between running workers");
+            std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        }
+        log_recovery(result, record_path);
+
+        for (const auto& path : trace_store::segment_paths(data_file_path))
+        {
+            if (path == record_path)
+                continue;
+
+            std::vector<std::wstring> other_files;
+            if (is_deduplication_enabled())
+                other_files = trace_store::other_segment_paths(data_file_path, path);
+            log_recovery(trace_journal::recover(path, keep_partial, is_deduplication_enabled(), std::move(other_files)), path);
+        }
+
+        journal.emplace(record_path, memory_resource);
+    }
+
+    void log_recovery(trace_journal::recovery_result result, const std::wstring& path) const
+    {
+        switch (result)
+        {
+        case trace_journal::recovery_result::COMMITTED:
+            profiler.log<logging_level::INFO>(L"Committed trace of a previous run from the journal of ", path);
+            break;
+        case trace_journal::recovery_result::COMMITTED_PARTIAL:
+            profiler.log<logging_level::INFO>(L"Committed partial trace of a previous run from the journal of ", path);
+            break;
+        case trace_journal::recovery_result::DISCARDED:
+            profiler.log<logging_level::INFO>(L"Discarded trace journal of a previous run of ", path);
+            break;
+        case trace_journal::recovery_result::NONE:
+        case trace_journal::recovery_result::IN_USE:
+            break;
+        }
+    }
+
     std::thread create_debugger_loop_thread()
     {
         try
         {
+            if (is_data_file_enabled())
+                open_trace_journal();
+
             driver.emplace(profiler, memory_resource, thread_preemption_bound);
             std::thread thread(&thread_controller::thread_controller_loop, this, &*driver);
             SetThreadDescription(thread.native_handle(), L"DebuggerLoopThread");
@@ -270,17 +390,22 @@ public:
         if (!is_enabled)
             return;
 
+        // Before the function is on the call stack, the controller reads its key while this thread might be frozen
+        function_table::get_instance().intern(function);
+
         auto* thr_info = get_thread_info();
         if (!thr_info)
         {
             thread_info new_thr_info(profiler.get_thread_id(GetCurrentThreadId()));
             new_thr_info.call_stack_args->push_back(args);
+            new_thr_info.call_stack_objects->push_back(thread_info::entry_object(function, args));
             new_thr_info.call_stack->push_back(function);
             thr_info = register_thread_info(std::move(new_thr_info));
         }
         else
         {
             thr_info->call_stack_args->push_back(args);
+            thr_info->call_stack_objects->push_back(thread_info::entry_object(function, args));
             thr_info->call_stack->push_back(function);
         }
 
@@ -308,7 +433,12 @@ public:
             }
         }
         else if (thread_preemption_bound.strategy == thread_preemption_bound_strategy::EXIT)
+        {
+            // The run reached its bound, so its trace is complete
+            if (journal)
+                journal->flush(true);
             ExitProcess(0);
+        }
     }
 
     void method_leave(const function_spec* function)
@@ -325,12 +455,14 @@ public:
         {
             thr_info->call_stack.reset();
             thr_info->call_stack_args.reset();
+            thr_info->call_stack_objects.reset();
             deregister_thread_info(*thr_info);
         }
         else
         {
             thr_info->call_stack->pop_back();
             thr_info->call_stack_args->pop_back();
+            thr_info->call_stack_objects->pop_back();
         }
 
         if (profiler.is_entry_point(function))
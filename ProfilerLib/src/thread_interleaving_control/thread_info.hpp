@@ -24,10 +24,12 @@ class thread_info
 public:
     std::unique_ptr<std::vector<const function_spec*>> call_stack;
     std::unique_ptr<std::vector<std::vector<argument_data>>> call_stack_args;
+    std::unique_ptr<std::vector<net_reference>> call_stack_objects; // see entry_object
 
     explicit thread_info(thread_id thr_id)
         : thr_id(thr_id), thr_handle(OpenThread(THREAD_SUSPEND_RESUME, false, thr_id.native_id))
         , call_stack(new std::vector<const function_spec*>), call_stack_args(new std::vector<std::vector<argument_data>>)
+        , call_stack_objects(new std::vector<net_reference>)
     {
     }
 
@@ -36,6 +38,7 @@ public:
     thread_info(thread_info&& other) noexcept // non thread safe
         : thr_id(other.thr_id), thr_handle(other.thr_handle)
         , call_stack(std::move(other.call_stack)), call_stack_args(std::move(other.call_stack_args))
+        , call_stack_objects(std::move(other.call_stack_objects))
     {
         other.thr_handle = nullptr;
     }
@@ -50,6 +53,7 @@ public:
 
         call_stack = std::move(other.call_stack);
         call_stack_args = std::move(other.call_stack_args);
+        call_stack_objects = std::move(other.call_stack_objects);
 
         return *this;
     }
@@ -104,6 +108,27 @@ public:
         return marked_for_suspension.load();
     }
 
+    /// <summary>
+    /// Returns the object a function is called on ('this' of instance methods), nullptr if unknown.
+    /// Arguments refer to the frame of the function entry, so it must be called on entry, call_stack_objects keeps it for the leave.
+    /// </summary>
+    static net_reference entry_object(const function_spec* function, const std::vector<argument_data>& args)
+    {
+        if (function->is_static() || args.empty())
+            return nullptr;
+        return *static_cast<const net_reference*>(args.front().as<net_reference>());
+    }
+
+    /// <summary>
+    /// Returns the object the current function is called on, stored by its entry (see entry_object).
+    /// </summary>
+    net_reference current_object() const
+    {
+        if (!call_stack_objects || call_stack_objects->empty())
+            return nullptr;
+        return call_stack_objects->back();
+    }
+
     std::wstring pretty_current_function() const
     {
         std::wstring str;
@@ -2,11 +2,27 @@
 
 #include "../net_types.hpp"
 #include "../thread_id.hpp"
+#include "../cor_error_handling.hpp"
 #include "../utils/binary_fstream.hpp"
+#include "../utils/binary_buffer.hpp"
+#include "../utils/binary_reader.hpp"
+#include "../utils/mapped_file.hpp"
+#include "../utils/hash_combine.hpp"
 #include "../utils/tree_graph.hpp"
+#include "../utils/tree_traversal.hpp"
+#include "function_table.hpp"
 #include "thread_info.hpp"
+#include "trace_dedup.hpp"
+#include "trace_format.hpp"
 
 #include <vector>
+#include <algorithm>
+#include <bit>
+#include <cstdint>
+#include <limits>
+#include <unordered_map>
+#include <optional>
+#include <string_view>
 #include <memory_resource>
 
 #undef max
@@ -16,36 +32,359 @@ struct trace_item
     thread_id thr_id;
     const function_spec* function;
     std::size_t options_size;
+    net_reference object = nullptr; // see thread_info::current_object
+    std::uint64_t frozen_threads = 0; // counted ids of the frozen threads (see dpor::threads_mask), 0 if unknown
+    std::uint64_t backtrack = 0; // counted ids of the threads worth running here (see dpor::reduce_options), 0 if unknown
+    std::uint64_t asleep = 0; // counted ids of the frozen threads in the sleep set of the decision (see past_trace_item::asleep)
 };
 
+/// <summary>
+/// Item of a stored trace, the function is referred to by its key in <see cref="function_table"/>.
+/// </summary>
 struct past_trace_item
 {
     std::size_t counted_id;
-    std::wstring function_id;
+    function_table::key_t function_key;
     std::size_t options_size;
 
+    /// <summary>
+    /// Counted ids of the threads worth running at the decision (see dpor::reduce_options), 0 if unknown.
+    /// Edges of a call graph vertex merge the sets of all traces through them.
+    /// </summary>
+    std::uint64_t backtrack = 0;
+
+    /// <summary>
+    /// Counted ids of the frozen threads whose step at the decision was explored from an equivalent state (sleep sets
+    /// of the systematic driver), 0 if none. They are counted in options_size, edges merge the sets of all traces through them.
+    /// </summary>
+    std::uint64_t asleep = 0;
+
+    /// <summary>
+    /// Returns function id (pretty info) of the item, for storing and printing.
+    /// </summary>
+    [[nodiscard]] std::wstring_view function_id() const
+    {
+        return function_table::get_instance().get(function_key);
+    }
+
     friend binary_fstream& operator>>(binary_fstream& str, past_trace_item& item)
     {
+        std::wstring function_id;
         str >> item.counted_id
-            && str >> item.function_id
+            && str >> function_id
             && str >> item.options_size;
+        item.function_key = function_table::get_instance().intern(function_id);
         return str;
     }
 
     friend binary_fstream& operator<<(binary_fstream& str, const past_trace_item& item)
     {
         str << item.counted_id;
-        str << item.function_id;
+        str << std::wstring(item.function_id());
         str << item.options_size;
         return str;
     }
 
     friend bool operator==(const past_trace_item& lhs, const past_trace_item& rhs)
     {
-        return lhs.counted_id == rhs.counted_id && lhs.function_id == rhs.function_id;
+        return lhs.counted_id == rhs.counted_id && lhs.function_key == rhs.function_key;
     }
 };
 
+/// <summary>
+/// Non-owning <see cref="past_trace_item"/>, function_id points directly into the mapped trace file.
+/// </summary>
+struct past_trace_item_view
+{
+    static constexpr std::uint32_t NO_FUNCTION_INDEX = static_cast<std::uint32_t>(-1);
+
+    std::size_t counted_id;
+    std::wstring_view function_id;
+    std::size_t options_size;
+
+    /// <summary>
+    /// Index of function_id in the dictionary of the file (NO_FUNCTION_INDEX for version 1 files).
+    /// </summary>
+    std::uint32_t function_index;
+
+    /// <summary>
+    /// Key of function_id in <see cref="function_table"/>.
+    /// </summary>
+    function_table::key_t function_key;
+
+    std::uint64_t backtrack = 0;
+    std::uint64_t asleep = 0;
+
+    operator past_trace_item() const // NOLINT(google-explicit-constructor)
+    {
+        return { counted_id, function_key, options_size, backtrack, asleep };
+    }
+
+    friend bool operator==(const past_trace_item& lhs, const past_trace_item_view& rhs)
+    {
+        return lhs.counted_id == rhs.counted_id && lhs.function_key == rhs.function_key;
+    }
+
+    friend bool operator==(const past_trace_item_view& lhs, const past_trace_item_view& rhs)
+    {
+        return lhs.counted_id == rhs.counted_id && lhs.function_key == rhs.function_key;
+    }
+};
+
+/// <summary>
+/// Hash consistent with the exact equality of trace items (counted_id and function, options_size is ignored).
+/// Owning items and views of the same item hash equally.
+/// </summary>
+struct past_trace_item_hash
+{
+    std::size_t operator()(const past_trace_item& item) const
+    {
+        return tmt::hash_combine(item.counted_id, item.function_key);
+    }
+
+    std::size_t operator()(const past_trace_item_view& item) const
+    {
+        return tmt::hash_combine(item.counted_id, item.function_key);
+    }
+};
+
+/// <summary>
+/// Call graphs index the edges of vertices with many children (see tree_graph).
+/// </summary>
+template<>
+struct tree_graph_edge_hash<past_trace_item> : past_trace_item_hash
+{
+};
+
+namespace call_graph_utils
+{
+    /// <summary>
+    /// How the values of vertices are updated when traces are added to the call graph.
+    /// </summary>
+    enum class values_update : std::uint8_t
+    {
+        BATCH, // values are computed once all traces are added (linear in the size of the graph)
+        INCREMENTAL, // every trace propagates the change of values along its path (for a few traces added to a big graph)
+        DEFERRED, // values are not updated, the caller calls compute_values once it adds everything
+    };
+
+    /// <summary>
+    /// Returns the backtrack sets of the edges (get_edge(i) for i below edges_size) merged, 0 if none is known.
+    /// </summary>
+    template<typename GetEdge>
+    std::uint64_t backtrack_mask(std::size_t edges_size, GetEdge get_edge)
+    {
+        std::uint64_t backtrack = 0;
+        for (std::size_t i = 0; i < edges_size; ++i)
+            backtrack |= get_edge(i).backtrack;
+        return backtrack;
+    }
+
+    template<typename Vertex>
+    std::uint64_t backtrack_mask(const Vertex& vertex)
+    {
+        return backtrack_mask(vertex.edges_size(), [&vertex](std::size_t i) -> const past_trace_item& { return vertex.get_edge(i); });
+    }
+
+    /// <summary>
+    /// Returns the sleep sets of the edges (get_edge(i) for i below edges_size) merged, 0 if no thread is asleep.
+    /// </summary>
+    template<typename GetEdge>
+    std::uint64_t asleep_mask(std::size_t edges_size, GetEdge get_edge)
+    {
+        std::uint64_t asleep = 0;
+        for (std::size_t i = 0; i < edges_size; ++i)
+            asleep |= get_edge(i).asleep;
+        return asleep;
+    }
+
+    template<typename Vertex>
+    std::uint64_t asleep_mask(const Vertex& vertex)
+    {
+        return asleep_mask(vertex.edges_size(), [&vertex](std::size_t i) -> const past_trace_item& { return vertex.get_edge(i); });
+    }
+
+    /// <summary>
+    /// Returns the number of not yet explored options of a vertex with the edges (get_edge(i) for i below edges_size, at least one).
+    /// With known backtrack sets, these are their threads without an edge, other threads are not worth running there.
+    /// Asleep threads without an edge are not counted either, their steps were explored from an equivalent state.
+    /// </summary>
+    template<typename GetEdge>
+    int unexplored_options(std::size_t edges_size, GetEdge get_edge)
+    {
+        std::uint64_t explored = 0;
+        for (std::size_t i = 0; i < edges_size; ++i)
+        {
+            if (std::size_t counted_id = get_edge(i).counted_id; counted_id < std::numeric_limits<std::uint64_t>::digits)
+                explored |= std::uint64_t{ 1 } << counted_id;
+        }
+        std::uint64_t asleep = asleep_mask(edges_size, get_edge) & ~explored;
+
+        if (std::uint64_t backtrack = backtrack_mask(edges_size, get_edge); backtrack != 0)
+            return std::popcount(backtrack & ~explored & ~asleep);
+
+        // Any edge, options_size might differ if in some run the driver found out weird path
+        // Choosing maximum would lead to too many (hard to find) paths
+        // Choosing minimum would miss some executions
+        return std::max(0, static_cast<int>(get_edge(0).options_size - edges_size) - std::popcount(asleep));
+    }
+
+    template<typename Vertex>
+    int unexplored_options(const Vertex& vertex)
+    {
+        return unexplored_options(vertex.edges_size(), [&vertex](std::size_t i) -> const past_trace_item& { return vertex.get_edge(i); });
+    }
+
+    /// <summary>
+    /// Value of a vertex with children: the values of its children and the number of not yet explored options.
+    /// </summary>
+    template<typename Vertex>
+    int vertex_value(const Vertex& vertex)
+    {
+        int current_value = 0;
+        for (std::size_t j = 0; j < vertex.edges_size(); ++j)
+            current_value += vertex.next_vertex(j).value;
+
+        return current_value + unexplored_options(vertex);
+    }
+
+    /// <summary>
+    /// Adds single trace (range of past_trace_item or past_trace_item_view) as a path to the call graph, values are not updated.
+    /// Backtrack and sleep sets of the items are merged into the edges already there.
+    /// Returns the deepest vertex of the path and the shallowest vertex that got a new child or new backtrack or asleep threads
+    /// (nullptr if the path was already there with the same sets). The path ends at a collapsed vertex, its subtree is already explored.
+    /// </summary>
+    template<typename Alloc, typename Trace>
+    auto add_path(tree_graph<int, past_trace_item, std::equal_to<>, Alloc>& call_graph, const Trace& trace)
+    {
+        using graph_vertex = typename tree_graph<int, past_trace_item, std::equal_to<>, Alloc>::graph_vertex;
+
+        graph_vertex* vertex = &call_graph.root();
+        graph_vertex* branch = nullptr;
+        for (const auto& trace_item : trace)
+        {
+            if (vertex->is_collapsed())
+                break;
+
+            std::size_t edges_size = vertex->edges_size();
+            graph_vertex* father = vertex;
+            vertex = &vertex->add_edge(trace_item, 0);
+
+            past_trace_item& edge = vertex->previous_edge();
+            bool new_threads = (edge.backtrack | trace_item.backtrack) != edge.backtrack || (edge.asleep | trace_item.asleep) != edge.asleep;
+            edge.backtrack |= trace_item.backtrack;
+            edge.asleep |= trace_item.asleep;
+
+            if (!branch && (father->edges_size() != edges_size || new_threads))
+                branch = father;
+        }
+
+        return std::pair{ vertex, branch };
+    }
+
+    /// <summary>
+    /// Computes the values of all vertices with a single post-order pass, leaves keep their values.
+    /// </summary>
+    template<typename Alloc>
+    void compute_values(tree_graph<int, past_trace_item, std::equal_to<>, Alloc>& call_graph)
+    {
+        for (auto& vertex : tree_traversal::post_order(call_graph.root()))
+        {
+            if (vertex.edges_size() > 0)
+                vertex.value = vertex_value(vertex);
+        }
+    }
+
+    /// <summary>
+    /// Adds single trace (range of past_trace_item or past_trace_item_view) as a path to the call graph and updates the values of its vertices.
+    /// Only the new part of the path is computed, the ancestors of the branching vertex change by the same difference.
+    /// </summary>
+    template<typename Alloc, typename Trace>
+    void add_trace(tree_graph<int, past_trace_item, std::equal_to<>, Alloc>& call_graph, const Trace& trace)
+    {
+        auto [vertex, branch] = add_path(call_graph, trace);
+        if (!branch)
+            return;
+
+        // vertices below the branch are new or got new backtrack or asleep threads
+        while ((vertex = vertex->previous_vertex()) != branch)
+            vertex->value = vertex_value(*vertex);
+
+        int old_value = branch->value;
+        branch->value = vertex_value(*branch);
+
+        int difference = branch->value - old_value;
+        for (vertex = branch->previous_vertex(); vertex != nullptr && difference != 0; vertex = vertex->previous_vertex())
+            vertex->value += difference;
+    }
+
+    /// <summary>
+    /// Adds all paths of source to the call graph, new edges are ordered after the edges already there, values are not updated.
+    /// Merging graphs of consecutive traces in their order gives the same graph as adding the traces one by one.
+    /// </summary>
+    template<typename Alloc, typename SourceAlloc>
+    void merge_paths(tree_graph<int, past_trace_item, std::equal_to<>, Alloc>& call_graph, const tree_graph<int, past_trace_item, std::equal_to<>, SourceAlloc>& source)
+    {
+        using graph_vertex = typename tree_graph<int, past_trace_item, std::equal_to<>, Alloc>::graph_vertex;
+        using source_vertex = typename tree_graph<int, past_trace_item, std::equal_to<>, SourceAlloc>::graph_vertex;
+
+        struct merged_vertex
+        {
+            graph_vertex* vertex;
+            const source_vertex* source;
+            std::size_t next_child;
+        };
+
+        std::vector<merged_vertex> stack{ { &call_graph.root(), &source.root(), 0 } };
+        while (!stack.empty())
+        {
+            auto& [vertex, source_vertex, next_child] = stack.back();
+            if (next_child == source_vertex->edges_size())
+            {
+                stack.pop_back();
+                continue;
+            }
+
+            std::size_t index = next_child++;
+            const auto& source_edge = source_vertex->get_edge(index);
+            auto& child = vertex->add_edge(source_edge, 0);
+            child.previous_edge().backtrack |= source_edge.backtrack;
+            child.previous_edge().asleep |= source_edge.asleep;
+            if (!child.is_collapsed())
+                stack.push_back({ &child, &source_vertex->next_vertex(index), 0 });
+        }
+    }
+
+    /// <summary>
+    /// Collapses subtrees whose value is 0 (every path in them was explored) into their top vertex, see tree_graph::collapse.
+    /// The root is never collapsed, so a graph with all paths explored is not mistaken for an empty one.
+    /// Values must be computed and not pruned, a collapsed subtree is never explored again.
+    /// </summary>
+    template<typename Alloc>
+    void collapse_exhausted(tree_graph<int, past_trace_item, std::equal_to<>, Alloc>& call_graph)
+    {
+        using graph_vertex = typename tree_graph<int, past_trace_item, std::equal_to<>, Alloc>::graph_vertex;
+
+        tree_traversal::visit_pre_order(call_graph.root(), [&call_graph](graph_vertex& vertex, std::size_t depth)
+        {
+            if (depth == 0 || vertex.value != 0 || vertex.edges_size() == 0)
+                return tree_traversal::control::CONTINUE;
+
+            call_graph.collapse(vertex);
+            return tree_traversal::control::SKIP_CHILDREN;
+        });
+    }
+
+    template<typename Alloc, typename Trace>
+    void add_trace(tree_graph<int, past_trace_item, std::equal_to<>, Alloc>& call_graph, const Trace& trace, values_update update)
+    {
+        if (update == values_update::INCREMENTAL)
+            add_trace(call_graph, trace);
+        else
+            add_path(call_graph, trace);
+    }
+}
+
 class trace
 {
     std::pmr::vector<std::pmr::vector<trace_item>> trace_log;
@@ -64,11 +403,11 @@ public:
         add_internal(thr_info, total_options_size);
     }
 
-    void add(const std::pmr::vector<thread_info*>& thr_infos, std::size_t total_options_size)
+    void add(const std::pmr::vector<thread_info*>& thr_infos, std::size_t total_options_size, std::uint64_t frozen_threads = 0, std::uint64_t asleep = 0)
     {
         trace_log.emplace_back();
         for (const thread_info* thr_info : thr_infos)
-            add_internal(thr_info, total_options_size);
+            add_internal(thr_info, total_options_size, frozen_threads, asleep);
 
         if (trace_log.back().empty())
             trace_log.pop_back();
@@ -82,104 +421,240 @@ public:
                 f(item);
     }
 
+    template<typename F>
+    void for_each(F f)
+    {
+        for (auto& vec : trace_log)
+            for (trace_item& item : vec)
+                f(item);
+    }
+
     [[nodiscard]] std::size_t size() const
     {
         return trace_log.size();
     }
 
+    /// <summary>
+    /// Returns number of items, a single scheduling decision may run several threads.
+    /// </summary>
+    [[nodiscard]] std::size_t items_size() const
+    {
+        std::size_t items = 0;
+        for (const auto& vec : trace_log)
+            items += vec.size();
+        return items;
+    }
+
 private:
-    void add_internal(const thread_info* thr_info, std::size_t total_options_size)
+    void add_internal(const thread_info* thr_info, std::size_t total_options_size, std::uint64_t frozen_threads = 0, std::uint64_t asleep = 0)
     {
         if (thr_info->call_stack)
-            trace_log.back().emplace_back(thr_info->get_thread_id(), thr_info->call_stack->back(), total_options_size);
+            trace_log.back().emplace_back(thr_info->get_thread_id(), thr_info->call_stack->back(), total_options_size, thr_info->current_object(), frozen_threads,
+                0, asleep);
     }
 };
 
 class trace_file
 {
     binary_fstream data_stream;
-    static constexpr std::size_t BLOCKS_SIZE = 256;
+    trace_format::version_t version;
+
+    // Version 1 index
+    std::vector<std::streamoff> block_offsets;
+
+    // Version 2 and later index and dictionary, loaded lazily and kept in sync with the last seen commit
+    std::vector<std::streamoff> trace_offsets;
+    std::vector<std::streamoff> trace_ends;
+    std::streamoff indexed_commit;
+    std::vector<std::wstring> dictionary;
+    std::vector<function_table::key_t> dictionary_keys;
+    std::unordered_map<function_table::key_t, std::uint32_t> dictionary_index;
+    std::streamoff loaded_dictionary;
+
+    // Path of the sidecars, empty if the file was opened from a stream
+    std::wstring path;
+    bool deduplicate;
+
+    // Fingerprints of this file and of the other files searched for identical traces, loaded by the first deduplicated append
+    std::optional<trace_dedup::fingerprint_index> fingerprints;
+    std::vector<std::wstring> other_files;
+    std::vector<trace_dedup::fingerprint_index> other_fingerprints;
+
+    struct indexed_item
+    {
+        std::size_t counted_id;
+        std::uint32_t function_index;
+        std::size_t options_size;
+        std::uint64_t backtrack;
+        std::uint64_t asleep;
+    };
 
 public:
+    static constexpr std::size_t BLOCKS_SIZE = trace_format::BLOCKS_SIZE;
+
+    enum class append_result : std::uint8_t
+    {
+        APPENDED,
+        COUNTED, // identical trace is already stored, only its hit count was increased
+    };
+
     explicit trace_file(const std::wstring& path)
         : data_stream(path, binary_fstream::append)
+        , version(trace_format::CURRENT_VERSION), indexed_commit(0), loaded_dictionary(0)
+        , path(path), deduplicate(false)
     {
         if (data_stream.is_empty_file())
         {
-            // total traces_count
-            data_stream << static_cast<std::size_t>(0);
+            data_stream << trace_format::MAGIC << static_cast<std::uint32_t>(version) << static_cast<std::streamoff>(0);
         }
+        else
+            read_version();
     }
 
     trace_file(const std::wstring& path, binary_fstream::input_t)
-        : data_stream(path, binary_fstream::input)
+        : trace_file(binary_fstream(path, binary_fstream::input))
     {
     }
 
     trace_file(binary_fstream&& stream)
         : data_stream(std::move(stream))
+        , version(trace_format::CURRENT_VERSION), indexed_commit(0), loaded_dictionary(0)
+        , deduplicate(false)
+    {
+        read_version();
+    }
+
+    /// <summary>
+    /// Identical traces (see past_trace_item equality) are stored once, appending one again only adds a hit to
+    /// the stored trace (see trace_dedup). Applies to version 2 and later files opened with a path.
+    /// Traces are looked up in other_files as well (other segments of the data file, see trace_store), they are not appended to.
+    /// </summary>
+    void set_deduplication(bool enabled, std::vector<std::wstring> other_files = {})
+    {
+        deduplicate = enabled;
+        this->other_files = std::move(other_files);
+        other_fingerprints.clear();
+    }
+
+    [[nodiscard]] trace_format::version_t get_version() const
     {
+        return version;
     }
 
     std::size_t traces_size()
     {
-        data_stream.seek(std::ios::beg);
+        if (version == trace_format::version_t::V1)
+        {
+            data_stream.seek(std::ios::beg);
 
-        std::size_t size;
-        data_stream >> size;
-        return size;
+            std::size_t size;
+            data_stream >> size;
+            return size;
+        }
+
+        std::streamoff last_commit = read_last_commit_offset();
+        return last_commit ? read_commit(last_commit).traces_count : 0;
     }
 
     template<typename Alloc>
     void get_trace(std::size_t index, std::vector<past_trace_item, Alloc>& past_traces)
     {
-        seek_to_trace_offset(index);
-        std::streamoff trace_pos;
-        data_stream >> trace_pos;
+        if (version == trace_format::version_t::V1)
+        {
+            seek_to_trace_offset(index);
+            std::streamoff trace_pos;
+            data_stream >> trace_pos;
 
-        data_stream.seek(trace_pos);
+            data_stream.seek(trace_pos);
 
-        data_stream >> past_traces;
-    }
+            data_stream >> past_traces;
+            return;
+        }
 
-    void append_trace(const trace& trace)
-    {
-        std::size_t traces_count = traces_size();
+        load_index();
 
-        if (traces_count % BLOCKS_SIZE == 0)
-        {
-            data_stream.seek(std::ios::end);
-            std::streamoff new_block_offset = data_stream.tell();
+        // Trace is followed by its commit, it is read at once and parsed in memory
+        std::streamoff trace_offset = trace_offsets.at(index);
+        std::vector<char> bytes(static_cast<std::size_t>(trace_ends[index] - trace_offset));
+        data_stream.seek(trace_offset);
+        if (!data_stream.read(bytes))
+            bytes.clear();
 
-            // new block of traces offsets
-            for (std::size_t i = 0; i < BLOCKS_SIZE; ++i)
-                data_stream << static_cast<std::streamoff>(0);
+        binary_reader reader(std::as_bytes(std::span<const char>(bytes)));
+        std::size_t items_count = 0;
+        if (version == trace_format::version_t::V2)
+            reader.read(items_count);
+        else
+            reader.read_varint(items_count);
 
-            // offset of following block
-            data_stream << static_cast<std::streamoff>(0);
+        trace_format::item_codec codec(version);
+        past_traces.resize(std::min(items_count, reader.remaining()));
+        for (auto& item : past_traces)
+        {
+            std::uint32_t function_index = 0;
+            if (!read_item(reader, codec, item.counted_id, function_index, item.options_size, item.backtrack, item.asleep))
+                break;
+            item.function_key = dictionary_keys.at(function_index);
+        }
+    }
 
-            if (traces_count)
+    append_result append_trace(const trace& trace)
+    {
+        if (version == trace_format::version_t::V1)
+        {
+            append_trace_v1(trace.items_size(), [&trace](binary_buffer& buffer)
             {
-                data_stream.seek(get_block_offset(traces_count / BLOCKS_SIZE - 1));
-                data_stream.seek(std::ios::cur, trace_offset_in_block(BLOCKS_SIZE));
-                data_stream << new_block_offset;
-            }
+                trace.for_each([&buffer](const trace_item& item)
+                {
+                    buffer << item.thr_id.counted_id << item.function->get_pretty_info() << item.options_size;
+                });
+            });
+            return append_result::APPENDED;
         }
 
-        data_stream.seek(std::ios::end);
-        std::streamoff cur_trace_pos = data_stream.tell();
+        auto commit = begin_commit();
+        bool dictionary_changed = commit.dictionary_offset == 0;
 
-        data_stream << trace.size();
-        trace.for_each([this](const trace_item& item)
+        // Pretty info of each function is looked up only once
+        std::unordered_map<const function_spec*, std::uint32_t> function_indices;
+        std::vector<indexed_item> items;
+        items.reserve(trace.items_size());
+        trace.for_each([&](const trace_item& item)
         {
-            data_stream << item.thr_id.counted_id << item.function->get_pretty_info() << item.options_size;
+            auto iter = function_indices.find(item.function);
+            if (iter == function_indices.end())
+                iter = function_indices.emplace(item.function, intern_function_id(function_table::get_instance().intern(item.function), dictionary_changed)).first;
+            items.push_back({ item.thr_id.counted_id, iter->second, item.options_size, item.backtrack, item.asleep });
         });
 
-        seek_to_trace_offset(traces_count);
-        data_stream << cur_trace_pos;
+        return append_trace_v2(commit, dictionary_changed, items);
+    }
 
-        data_stream.seek(std::ios::beg);
-        data_stream << traces_count + 1;
+    /// <summary>
+    /// Appends already stored trace (e.g. recovered from a journal or read from another data file).
+    /// </summary>
+    template<typename Alloc>
+    append_result append_trace(const std::vector<past_trace_item, Alloc>& past_trace)
+    {
+        if (version == trace_format::version_t::V1)
+        {
+            append_trace_v1(past_trace.size(), [&past_trace](binary_buffer& buffer)
+            {
+                for (const auto& item : past_trace)
+                    buffer << item.counted_id << item.function_id() << item.options_size;
+            });
+            return append_result::APPENDED;
+        }
+
+        auto commit = begin_commit();
+        bool dictionary_changed = commit.dictionary_offset == 0;
+
+        std::vector<indexed_item> items;
+        items.reserve(past_trace.size());
+        for (const auto& item : past_trace)
+            items.push_back({ item.counted_id, intern_function_id(item.function_key, dictionary_changed), item.options_size, item.backtrack, item.asleep });
+
+        return append_trace_v2(commit, dictionary_changed, items);
     }
 
     void populate_call_graph(pmr::tree_graph<int, past_trace_item>& call_graph, std::pmr::memory_resource* mem_res)
@@ -206,31 +681,357 @@ private:
     template<typename Alloc>
     void populate_call_graph_impl(tree_graph<int, past_trace_item, std::equal_to<>, Alloc>& call_graph, Alloc alloc = Alloc{})
     {
-        for (std::size_t i = 0; i < traces_size(); ++i)
+        std::vector<past_trace_item, Alloc> trace(alloc);
+        for (std::size_t i = 0, size = traces_size(); i < size; ++i)
         {
-            std::vector<past_trace_item, Alloc> trace(alloc);
+            trace.clear();
             get_trace(i, trace);
+            call_graph_utils::add_path(call_graph, trace);
+        }
+        call_graph_utils::compute_values(call_graph);
+    }
+
+    void read_version()
+    {
+        data_stream.seek(std::ios::end);
+        if (data_stream.tell() < trace_format::HEADER_SIZE)
+        {
+            version = trace_format::version_t::V1;
+            return;
+        }
+
+        data_stream.seek(std::ios::beg);
+        std::uint32_t first_word, second_word;
+        data_stream >> first_word >> second_word;
+        version = trace_format::detect_version(first_word, second_word);
+    }
+
+    template<typename SerializeItems>
+    void append_trace_v1(std::size_t items_size, SerializeItems serialize_items)
+    {
+        std::size_t traces_count = traces_size();
+        bool new_block = traces_count % BLOCKS_SIZE == 0;
+
+        data_stream.seek(std::ios::end);
+        std::streamoff end_offset = data_stream.tell();
+
+        // New block (if needed) and the trace are serialized together, the slot of the trace in a new block is known upfront
+        binary_buffer buffer;
+        std::streamoff cur_trace_pos = end_offset;
+        if (new_block)
+        {
+            cur_trace_pos += static_cast<std::streamoff>(BLOCKS_SIZE + 1) * sizeof(std::streamoff);
+
+            buffer << cur_trace_pos;
+            // rest of the block of traces offsets and offset of following block
+            for (std::size_t i = 1; i < BLOCKS_SIZE + 1; ++i)
+                buffer << static_cast<std::streamoff>(0);
+        }
+
+        buffer << items_size;
+        serialize_items(buffer);
+
+        data_stream.write(buffer.bytes());
+
+        if (new_block)
+        {
+            if (traces_count)
+            {
+                data_stream.seek(get_block_offset(traces_count / BLOCKS_SIZE - 1));
+                data_stream.seek(std::ios::cur, trace_offset_in_block(BLOCKS_SIZE));
+                data_stream << end_offset;
+            }
+
+            if (block_offsets.size() == traces_count / BLOCKS_SIZE)
+                block_offsets.push_back(end_offset);
+        }
+        else
+        {
+            seek_to_trace_offset(traces_count);
+            data_stream << cur_trace_pos;
+        }
 
-            // Add traces as edges to graph
-            auto* vertex = &call_graph.root();
-            for (auto& trace_item : trace)
-                vertex = &vertex->add_edge(trace_item, 0);
+        data_stream.seek(std::ios::beg);
+        data_stream << traces_count + 1;
+    }
 
-            // backtrack to root and update the value of vertices
-            while ((vertex = vertex->previous_vertex()) != nullptr)
+    /// <summary>
+    /// Prepares commit record of the next trace and loads the dictionary of the last commit.
+    /// Dictionary offset of the returned commit is 0 if there is no dictionary yet.
+    /// </summary>
+    trace_format::commit_record begin_commit()
+    {
+        trace_format::commit_record commit{ read_last_commit_offset(), 0, 0, 0 };
+        if (commit.previous_commit)
+        {
+            auto last_commit = read_commit(commit.previous_commit);
+            commit.dictionary_offset = last_commit.dictionary_offset;
+            commit.traces_count = last_commit.traces_count;
+            load_dictionary(last_commit.dictionary_offset);
+        }
+        ++commit.traces_count;
+        return commit;
+    }
+
+    std::uint32_t intern_function_id(function_table::key_t function_key, bool& dictionary_changed)
+    {
+        auto [iter, inserted] = dictionary_index.try_emplace(function_key, static_cast<std::uint32_t>(dictionary.size()));
+        if (inserted)
+        {
+            dictionary.emplace_back(function_table::get_instance().get(function_key));
+            dictionary_keys.push_back(function_key);
+            dictionary_changed = true;
+        }
+        return iter->second;
+    }
+
+    void write_item(binary_buffer& buffer, trace_format::item_codec& codec, const indexed_item& item) const
+    {
+        if (version == trace_format::version_t::V2)
+            buffer << item.counted_id << item.function_index << item.options_size;
+        else
+            codec.write(buffer, item.counted_id, item.function_index, item.options_size, item.backtrack, item.asleep);
+    }
+
+    bool read_item(binary_reader& reader, trace_format::item_codec& codec, std::size_t& counted_id, std::uint32_t& function_index, std::size_t& options_size,
+        std::uint64_t& backtrack, std::uint64_t& asleep) const
+    {
+        if (version == trace_format::version_t::V2)
+            return reader.read(counted_id) && reader.read(function_index) && reader.read(options_size);
+        return codec.read(reader, counted_id, function_index, options_size, backtrack, asleep);
+    }
+
+    /// <summary>
+    /// Appends trace to version 2, 3, 4 or 5 file (all share the same structure, see trace_format).
+    /// </summary>
+    append_result append_trace_v2(trace_format::commit_record commit, bool dictionary_changed, std::vector<indexed_item>& items)
+    {
+        trace_format::fingerprint fingerprint;
+        if (deduplicate && !path.empty())
+        {
+            for (const auto& item : items)
+                fingerprint.add(item.counted_id, dictionary[item.function_index]);
+
+            if (auto same = find_stored(commit.traces_count - 1, dictionary_changed, fingerprint.get(), items))
             {
-                int current_value = 0;
-                for (std::size_t j = 0; j < vertex->edges_size(); ++j)
-                    current_value += vertex->next_vertex(j).value;
+                trace_dedup::add_hit(same->first, same->second);
+                return append_result::COUNTED;
+            }
+        }
 
-                // Any edge, options_size might differ if in some run the driver found out weird path
-                // Choosing maximum would lead to too many (hard to find) paths
-                // Choosing minimum would miss some executions
-                current_value += std::max(0, static_cast<int>(vertex->get_edge(0).options_size - vertex->edges_size()));
+        data_stream.seek(std::ios::end);
+        std::streamoff end_offset = data_stream.tell();
 
-                vertex->value = current_value;
+        // Dictionary (if changed), trace and its commit are stored with a single write
+        binary_buffer buffer(items.size() * trace_format::V2_ITEM_SIZE + sizeof(trace_format::commit_record));
+        if (dictionary_changed)
+        {
+            commit.dictionary_offset = end_offset;
+            if (version == trace_format::version_t::V2)
+                buffer << dictionary;
+            else
+            {
+                binary_buffer strings;
+                strings.write_varint(dictionary.size());
+                for (const auto& function_id : dictionary)
+                    strings.write_varint_string(function_id);
+                buffer << static_cast<std::uint64_t>(strings.size());
+                buffer.write(strings.bytes());
             }
         }
+
+        commit.trace_offset = end_offset + static_cast<std::streamoff>(buffer.size());
+        if (version == trace_format::version_t::V2)
+            buffer << items.size();
+        else
+            buffer.write_varint(items.size());
+
+        trace_format::item_codec codec(version);
+        for (const auto& item : items)
+            write_item(buffer, codec, item);
+
+        std::streamoff commit_offset = end_offset + static_cast<std::streamoff>(buffer.size());
+        if (version == trace_format::version_t::V2)
+            buffer << commit.previous_commit << commit.trace_offset << commit.dictionary_offset << commit.traces_count;
+        else
+        {
+            buffer << static_cast<std::uint64_t>(commit.previous_commit) << static_cast<std::uint64_t>(commit.trace_offset)
+                << static_cast<std::uint64_t>(commit.dictionary_offset) << static_cast<std::uint64_t>(commit.traces_count);
+        }
+
+        data_stream.write(buffer.bytes());
+
+        // Make the trace visible only once it is completely written
+        data_stream.seek(trace_format::LAST_COMMIT_OFFSET);
+        data_stream << commit_offset;
+
+        loaded_dictionary = commit.dictionary_offset;
+
+        if (deduplicate && fingerprints && data_stream)
+            fingerprints->add(fingerprint.get());
+        return append_result::APPENDED;
+    }
+
+    /// <summary>
+    /// Returns path of the file and index of a stored trace identical to items, this file is searched first.
+    /// Stored trace of the same schedule is identical only if it has all backtrack and asleep threads of items (see dpor and
+    /// past_trace_item::asleep), otherwise its threads are added to items: the appended trace covers the stored one, so the last
+    /// trace of a schedule covers all.
+    /// Fingerprints are loaded on the first call, fingerprints missing in this file are computed then.
+    /// </summary>
+    std::optional<std::pair<std::wstring, std::size_t>> find_stored(std::size_t traces_count, bool dictionary_changed, std::uint64_t fingerprint,
+        std::vector<indexed_item>& items)
+    {
+        if (!fingerprints)
+            fingerprints.emplace(path);
+        fingerprints->sync(traces_count, [this, stored = std::vector<past_trace_item>()](std::size_t index) mutable { return stored_fingerprint(index, stored); });
+
+        if (other_fingerprints.empty())
+        {
+            for (const auto& other_path : other_files)
+                other_fingerprints.emplace_back(other_path);
+        }
+
+        // Files without backtrack threads (before version 4) store only the schedule, sleep sets are stored since version 5
+        bool stores_backtrack = version >= trace_format::version_t::V4;
+        bool stores_asleep = version >= trace_format::version_t::V5;
+        std::vector<past_trace_item> stored;
+        auto is_same = [&](trace_file& file, std::size_t index)
+        {
+            stored.clear();
+            file.get_trace(index, stored);
+            bool same_schedule = std::ranges::equal(stored, items, [this](const past_trace_item& lhs, const indexed_item& rhs)
+            {
+                return lhs.counted_id == rhs.counted_id && lhs.function_key == dictionary_keys[rhs.function_index];
+            });
+            if (!same_schedule || !stores_backtrack)
+                return same_schedule;
+
+            bool covered = true;
+            for (std::size_t i = 0; i < items.size(); ++i)
+            {
+                covered = covered && (items[i].backtrack & ~stored[i].backtrack) == 0 && (!stores_asleep || (items[i].asleep & ~stored[i].asleep) == 0);
+                items[i].backtrack |= stored[i].backtrack;
+                items[i].asleep |= stored[i].asleep;
+            }
+            return covered;
+        };
+
+        // Trace with a function id new to the dictionary cannot be stored in this file already
+        if (auto index = dictionary_changed ? std::nullopt : fingerprints->find(fingerprint); index && is_same(*this, *index))
+            return std::pair(path, *index);
+
+        for (std::size_t i = 0; i < other_files.size(); ++i)
+        {
+            auto index = other_fingerprints[i].find(fingerprint);
+            if (!index)
+                continue;
+
+            trace_file other(other_files[i], binary_fstream::input);
+            if (other && *index < other.traces_size() && is_same(other, *index))
+                return std::pair(other_files[i], *index);
+        }
+        return std::nullopt;
+    }
+
+    std::uint64_t stored_fingerprint(std::size_t index, std::vector<past_trace_item>& stored)
+    {
+        stored.clear();
+        get_trace(index, stored);
+
+        trace_format::fingerprint fingerprint;
+        for (const auto& item : stored)
+            fingerprint.add(item.counted_id, item.function_id());
+        return fingerprint.get();
+    }
+
+    std::streamoff read_last_commit_offset()
+    {
+        data_stream.seek(trace_format::LAST_COMMIT_OFFSET);
+        std::streamoff last_commit = 0;
+        data_stream >> last_commit;
+        return last_commit;
+    }
+
+    trace_format::commit_record read_commit(std::streamoff offset)
+    {
+        trace_format::commit_record commit{};
+        data_stream.seek(offset);
+        if (version == trace_format::version_t::V2)
+        {
+            data_stream >> commit.previous_commit >> commit.trace_offset >> commit.dictionary_offset >> commit.traces_count;
+            return commit;
+        }
+
+        std::uint64_t previous_commit = 0, trace_offset = 0, dictionary_offset = 0, traces_count = 0;
+        data_stream >> previous_commit >> trace_offset >> dictionary_offset >> traces_count;
+        return { static_cast<std::streamoff>(previous_commit), static_cast<std::streamoff>(trace_offset),
+            static_cast<std::streamoff>(dictionary_offset), static_cast<std::size_t>(traces_count) };
+    }
+
+    void load_dictionary(std::streamoff dictionary_offset)
+    {
+        if (dictionary_offset == loaded_dictionary)
+            return;
+
+        data_stream.seek(dictionary_offset);
+        if (version == trace_format::version_t::V2)
+            data_stream >> dictionary;
+        else
+        {
+            std::uint64_t bytes_size = 0;
+            data_stream >> bytes_size;
+            std::vector<char> bytes(data_stream ? static_cast<std::size_t>(bytes_size) : 0);
+            data_stream.read(bytes);
+
+            binary_reader reader(std::as_bytes(std::span<const char>(bytes)));
+            std::size_t strings_count = 0;
+            reader.read_varint(strings_count);
+            dictionary.resize(std::min(strings_count, reader.remaining()));
+            for (auto& function_id : dictionary)
+                reader.read_varint_string(function_id);
+        }
+
+        dictionary_keys.clear();
+        dictionary_index.clear();
+        for (std::uint32_t i = 0; i < dictionary.size(); ++i)
+        {
+            dictionary_keys.push_back(function_table::get_instance().intern(dictionary[i]));
+            dictionary_index.emplace(dictionary_keys.back(), i);
+        }
+
+        loaded_dictionary = dictionary_offset;
+    }
+
+    void load_index()
+    {
+        std::streamoff last_commit_offset = read_last_commit_offset();
+        if (last_commit_offset == indexed_commit)
+            return;
+
+        // Walk back only through the commits appended since the index was loaded
+        std::vector<std::streamoff> new_offsets;
+        std::vector<std::streamoff> new_ends;
+        std::streamoff dictionary_offset = 0;
+        for (std::streamoff commit_offset = last_commit_offset; commit_offset != indexed_commit && commit_offset != 0;)
+        {
+            auto commit = read_commit(commit_offset);
+            if (!data_stream)
+                break;
+            if (!dictionary_offset)
+                dictionary_offset = commit.dictionary_offset;
+
+            new_offsets.push_back(commit.trace_offset);
+            new_ends.push_back(commit_offset);
+            commit_offset = commit.previous_commit;
+        }
+
+        trace_offsets.insert(trace_offsets.end(), new_offsets.rbegin(), new_offsets.rend());
+        trace_ends.insert(trace_ends.end(), new_ends.rbegin(), new_ends.rend());
+        indexed_commit = last_commit_offset;
+
+        if (dictionary_offset)
+            load_dictionary(dictionary_offset);
     }
 
     void seek_to_trace_offset(std::size_t trace_index)
@@ -246,16 +1047,293 @@ private:
 
     std::ios::pos_type get_block_offset(std::size_t block_index)
     {
-        data_stream.seek(std::ios::beg);
+        // Block chain is only ever extended, walk it once and remember the offsets
+        if (block_offsets.empty())
+            block_offsets.push_back(sizeof(std::size_t));
 
-        std::streamoff offset = sizeof(std::size_t);
-        while (block_index-- > 0)
+        while (block_offsets.size() <= block_index)
         {
-            offset += static_cast<long long>(BLOCKS_SIZE) * sizeof(std::streamoff);
+            std::streamoff offset = block_offsets.back() + static_cast<long long>(BLOCKS_SIZE) * sizeof(std::streamoff);
             data_stream.seek(offset);
             data_stream >> offset;
+            block_offsets.push_back(offset);
+        }
+
+        return block_offsets[block_index];
+    }
+};
+
+/// <summary>
+/// Read-only access to the trace data file through a memory mapping.
+/// The index of trace offsets is built once when opened, so accessing any trace is O(1) and involves no stream operations.
+/// </summary>
+class mapped_trace_file
+{
+    mapped_file file;
+    trace_format::version_t version;
+    std::vector<std::size_t> trace_offsets;
+    std::vector<std::wstring_view> dictionary;
+    std::vector<function_table::key_t> dictionary_keys;
+    bool valid;
+
+public:
+    explicit mapped_trace_file(const std::wstring& path)
+        : file(path), version(trace_format::CURRENT_VERSION), valid(static_cast<bool>(file))
+    {
+        if (valid && file.size() > 0)
+            valid = build_index();
+    }
+
+    [[nodiscard]] trace_format::version_t get_version() const
+    {
+        return version;
+    }
+
+    [[nodiscard]] std::size_t traces_size() const
+    {
+        return trace_offsets.size();
+    }
+
+    /// <summary>
+    /// Returns function ids interned in the file, empty for version 1 files.
+    /// </summary>
+    [[nodiscard]] const std::vector<std::wstring_view>& get_dictionary() const
+    {
+        return dictionary;
+    }
+
+    [[nodiscard]] std::size_t get_trace_offset(std::size_t index) const
+    {
+        return trace_offsets.at(index);
+    }
+
+    /// <summary>
+    /// Calls f with <see cref="past_trace_item_view"/> for every item of the trace at given index.
+    /// Views are valid as long as this object lives.
+    /// </summary>
+    template<typename F>
+    void for_each_item(std::size_t index, F f) const
+    {
+        binary_reader reader(file.data(), trace_offsets.at(index));
+
+        std::size_t items_count = 0;
+        if (!(version >= trace_format::version_t::V3 ? reader.read_varint(items_count) : reader.read(items_count)))
+            throw profiler_error(L"Corrupted trace " + std::to_wstring(index));
+
+        trace_format::item_codec codec(version);
+        for (std::size_t i = 0; i < items_count; ++i)
+        {
+            past_trace_item_view item{ 0, {}, 0, past_trace_item_view::NO_FUNCTION_INDEX, function_table::EMPTY_KEY, 0, 0 };
+            bool ok;
+            if (version == trace_format::version_t::V1)
+                ok = reader.read(item.counted_id) && reader.read(item.function_id) && reader.read(item.options_size);
+            else if (version == trace_format::version_t::V2)
+                ok = reader.read(item.counted_id) && reader.read(item.function_index) && reader.read(item.options_size);
+            else
+                ok = codec.read(reader, item.counted_id, item.function_index, item.options_size, item.backtrack, item.asleep);
+
+            if (ok && version != trace_format::version_t::V1)
+            {
+                ok = item.function_index < dictionary.size();
+                if (ok)
+                {
+                    item.function_id = dictionary[item.function_index];
+                    item.function_key = dictionary_keys[item.function_index];
+                }
+            }
+            else if (ok)
+                item.function_key = function_table::get_instance().intern(item.function_id);
+
+            if (!ok)
+                throw profiler_error(L"Corrupted trace " + std::to_wstring(index));
+
+            f(item);
+        }
+    }
+
+    template<typename Alloc>
+    void get_trace(std::size_t index, std::vector<past_trace_item, Alloc>& past_traces) const
+    {
+        past_traces.clear();
+        for_each_item(index, [&past_traces](const past_trace_item_view& item) { past_traces.push_back(item); });
+    }
+
+    /// <summary>
+    /// Adds traces starting at first_trace to the call graph, earlier traces are expected to be there already.
+    /// </summary>
+    void populate_call_graph(pmr::tree_graph<int, past_trace_item>& call_graph, std::pmr::memory_resource* mem_res, std::size_t first_trace = 0,
+        call_graph_utils::values_update update = call_graph_utils::values_update::BATCH) const
+    {
+        populate_call_graph_impl(call_graph, mem_res, first_trace, update);
+    }
+
+    void populate_call_graph(tree_graph<int, past_trace_item>& call_graph, std::size_t first_trace = 0,
+        call_graph_utils::values_update update = call_graph_utils::values_update::BATCH) const
+    {
+        populate_call_graph_impl(call_graph, std::pmr::get_default_resource(), first_trace, update);
+    }
+
+    explicit operator bool() const
+    {
+        return valid;
+    }
+
+    bool operator!() const
+    {
+        return !valid;
+    }
+
+private:
+    template<typename Alloc>
+    void populate_call_graph_impl(tree_graph<int, past_trace_item, std::equal_to<>, Alloc>& call_graph, std::pmr::memory_resource* mem_res, std::size_t first_trace,
+        call_graph_utils::values_update update) const
+    {
+        // Views avoid copying the function ids of edges that are already in the graph
+        std::pmr::vector<past_trace_item_view> trace(mem_res);
+        for (std::size_t i = first_trace; i < traces_size(); ++i)
+        {
+            trace.clear();
+            for_each_item(i, [&trace](const past_trace_item_view& item) { trace.push_back(item); });
+            call_graph_utils::add_trace(call_graph, trace, update);
+        }
+
+        if (update == call_graph_utils::values_update::BATCH)
+            call_graph_utils::compute_values(call_graph);
+    }
+
+    bool build_index()
+    {
+        std::uint32_t first_word = 0, second_word = 0;
+        if (file.size() >= static_cast<std::size_t>(trace_format::HEADER_SIZE))
+        {
+            file.read(0, first_word);
+            file.read(sizeof(std::uint32_t), second_word);
+        }
+        version = trace_format::detect_version(first_word, second_word);
+
+        if (version == trace_format::version_t::V1)
+            return build_index_v1();
+        if (version >= trace_format::version_t::V2 && version <= trace_format::CURRENT_VERSION)
+            return build_index_v2();
+        return false;
+    }
+
+    bool build_index_v1()
+    {
+        std::size_t count;
+        if (!file.read(0, count))
+            return false;
+
+        trace_offsets.reserve(count);
+
+        std::size_t block_offset = sizeof(std::size_t);
+        for (std::size_t i = 0; i < count; ++i)
+        {
+            std::streamoff offset;
+            if (i > 0 && i % trace_format::BLOCKS_SIZE == 0)
+            {
+                // follow the link to the next block
+                if (!file.read(block_offset + trace_format::BLOCKS_SIZE * sizeof(std::streamoff), offset))
+                    return false;
+                block_offset = static_cast<std::size_t>(offset);
+            }
+
+            if (!file.read(block_offset + (i % trace_format::BLOCKS_SIZE) * sizeof(std::streamoff), offset) || offset <= 0)
+                return false;
+            trace_offsets.push_back(static_cast<std::size_t>(offset));
+        }
+
+        return true;
+    }
+
+    bool build_index_v2()
+    {
+        std::streamoff commit_offset;
+        if (!file.read(trace_format::LAST_COMMIT_OFFSET, commit_offset))
+            return false;
+        if (commit_offset == 0)
+            return true;
+
+        trace_format::commit_record last_commit{};
+        for (bool first = true; commit_offset != 0; first = false)
+        {
+            trace_format::commit_record commit{};
+            if (!read_commit(static_cast<std::size_t>(commit_offset), commit))
+                return false;
+
+            // commits are chained backwards, previous one has to be located before this one
+            if (commit.previous_commit >= commit_offset || commit.trace_offset >= commit_offset)
+                return false;
+
+            if (first)
+            {
+                last_commit = commit;
+                trace_offsets.reserve(commit.traces_count);
+            }
+
+            trace_offsets.push_back(static_cast<std::size_t>(commit.trace_offset));
+            commit_offset = commit.previous_commit;
+        }
+        std::ranges::reverse(trace_offsets);
+
+        if (trace_offsets.size() != last_commit.traces_count)
+            return false;
+
+        binary_reader reader(file.data(), static_cast<std::size_t>(last_commit.dictionary_offset));
+        if (version == trace_format::version_t::V2)
+        {
+            std::size_t strings_count;
+            if (!reader.read(strings_count) || strings_count > reader.remaining())
+                return false;
+
+            dictionary.resize(strings_count);
+            for (auto& str : dictionary)
+                if (!reader.read(str))
+                    return false;
+            return intern_dictionary();
+        }
+
+        std::size_t strings_count;
+        if (!reader.skip(sizeof(std::uint64_t)) || !reader.read_varint(strings_count) || strings_count > reader.remaining())
+            return false;
+
+        dictionary.resize(strings_count);
+        for (auto& str : dictionary)
+            if (!reader.read_varint_string(str))
+                return false;
+        return intern_dictionary();
+    }
+
+    /// <summary>
+    /// Keys of the dictionary are looked up once, items then get them by their index.
+    /// </summary>
+    bool intern_dictionary()
+    {
+        dictionary_keys.reserve(dictionary.size());
+        for (auto function_id : dictionary)
+            dictionary_keys.push_back(function_table::get_instance().intern(function_id));
+        return true;
+    }
+
+    bool read_commit(std::size_t offset, trace_format::commit_record& commit) const
+    {
+        if (version == trace_format::version_t::V2)
+        {
+            return file.read(offset, commit.previous_commit)
+                && file.read(offset + sizeof(std::streamoff), commit.trace_offset)
+                && file.read(offset + 2 * sizeof(std::streamoff), commit.dictionary_offset)
+                && file.read(offset + 3 * sizeof(std::streamoff), commit.traces_count);
+        }
+
+        std::uint64_t fields[4];
+        for (std::size_t i = 0; i < std::size(fields); ++i)
+        {
+            if (!file.read(offset + i * sizeof(std::uint64_t), fields[i]))
+                return false;
         }
 
-        return offset;
+        commit = { static_cast<std::streamoff>(fields[0]), static_cast<std::streamoff>(fields[1]),
+            static_cast<std::streamoff>(fields[2]), static_cast<std::size_t>(fields[3]) };
+        return fields[3] <= std::numeric_limits<std::size_t>::max();
     }
 };
@@ -0,0 +1,226 @@
+#pragma once
+
+#include "trace_format.hpp"
+
+#include "../utils/binary_buffer.hpp"
+#include "../utils/binary_fstream.hpp"
+#include "../utils/mapped_file.hpp"
+#include "../cor_error_handling.hpp"
+
+#include <span>
+#include <string>
+#include <vector>
+#include <optional>
+#include <functional>
+#include <filesystem>
+#include <format>
+#include <unordered_map>
+
+#include <Windows.h>
+
+/// <summary>
+/// Hit counts and fingerprints sidecars of the data file (see trace_format), identical traces are stored once
+/// and only the number of runs they stand for grows.
+/// </summary>
+namespace trace_dedup
+{
+    /// <summary>
+    /// Returns hit counts of the traces in the file, every trace stands for a single run if there are none.
+    /// </summary>
+    inline std::vector<std::size_t> read_hits(const std::wstring& data_file_path, std::size_t traces_count)
+    {
+        std::vector<std::size_t> hits(traces_count, 1);
+
+        mapped_file hits_file(trace_format::hits_path(data_file_path));
+        std::uint32_t magic = 0;
+        if (!hits_file || !hits_file.read(0, magic) || magic != trace_format::HITS_MAGIC)
+            return hits;
+
+        for (std::size_t i = 0; i < traces_count; ++i)
+        {
+            std::uint64_t count = 0;
+            if (hits_file.read(sizeof(std::uint32_t) + i * sizeof(std::uint64_t), count))
+                hits[i] = static_cast<std::size_t>(count);
+        }
+        return hits;
+    }
+
+    inline bool write_hits(const std::wstring& data_file_path, const std::vector<std::size_t>& hits)
+    {
+        binary_fstream hits_file(trace_format::hits_path(data_file_path), binary_fstream::output);
+        hits_file << trace_format::HITS_MAGIC;
+        for (std::size_t count : hits)
+            hits_file << static_cast<std::uint64_t>(count);
+        return static_cast<bool>(hits_file);
+    }
+
+    inline bool write_fingerprints(const std::wstring& data_file_path, const std::vector<std::uint64_t>& fingerprints)
+    {
+        binary_buffer buffer((fingerprints.size() + 1) * sizeof(std::uint64_t));
+        buffer << trace_format::FINGERPRINTS_MAGIC;
+        buffer.write(std::span<const std::uint64_t>(fingerprints));
+
+        binary_fstream fingerprints_file(trace_format::fingerprints_path(data_file_path), binary_fstream::output);
+        fingerprints_file.write(buffer.bytes());
+        return static_cast<bool>(fingerprints_file);
+    }
+
+    /// <summary>
+    /// Named mutex 'Local\ThreadFuzzerHits.(hash of hits file)', hits of a segment are added by every worker finding
+    /// an identical trace in it, not only by the worker appending to it.
+    /// </summary>
+    class hits_lock
+    {
+        HANDLE mutex_handle;
+
+    public:
+        explicit hits_lock(const std::wstring& data_file_path)
+        {
+            auto suffix = std::format(L"{:x}", std::hash<std::wstring>{}(std::filesystem::absolute(trace_format::hits_path(data_file_path)).wstring()));
+            mutex_handle = CreateMutex(nullptr, false, (L"Local\\ThreadFuzzerHits." + suffix).c_str());
+            if (!mutex_handle)
+                throw profiler_error(L"Cannot create hits file lock");
+
+            // Abandoned mutex (owner crashed) is acquired as well, a count is written with a single write
+            WaitForSingleObject(mutex_handle, INFINITE);
+        }
+
+        hits_lock(const hits_lock&) = delete;
+        hits_lock& operator=(const hits_lock&) = delete;
+
+        ~hits_lock()
+        {
+            ReleaseMutex(mutex_handle);
+            CloseHandle(mutex_handle);
+        }
+    };
+
+    /// <summary>
+    /// Adds a single run to the hit count of the trace, missing hit counts of preceding traces are filled with 1.
+    /// </summary>
+    inline bool add_hit(const std::wstring& data_file_path, std::size_t trace_index)
+    {
+        hits_lock lock(data_file_path);
+        binary_fstream hits_file(trace_format::hits_path(data_file_path), binary_fstream::append);
+        if (hits_file.is_empty_file())
+            hits_file << trace_format::HITS_MAGIC;
+        else
+        {
+            std::uint32_t magic = 0;
+            hits_file.seek(std::ios::beg);
+            if (!(hits_file >> magic) || magic != trace_format::HITS_MAGIC)
+                return false;
+        }
+
+        hits_file.seek(std::ios::end);
+        auto stored = (static_cast<std::size_t>(hits_file.tell()) - sizeof(std::uint32_t)) / sizeof(std::uint64_t);
+        if (stored <= trace_index)
+        {
+            // a partially written count at the end is overwritten
+            hits_file.seek(static_cast<std::streamoff>(sizeof(std::uint32_t) + stored * sizeof(std::uint64_t)));
+            for (; stored <= trace_index; ++stored)
+                hits_file << std::uint64_t{ 1 };
+        }
+
+        auto offset = static_cast<std::streamoff>(sizeof(std::uint32_t) + trace_index * sizeof(std::uint64_t));
+        std::uint64_t count = 0;
+        hits_file.seek(offset);
+        hits_file >> count;
+        hits_file.seek(offset);
+        hits_file << count + 1;
+        return static_cast<bool>(hits_file);
+    }
+
+    /// <summary>
+    /// Fingerprints of the traces stored in the data file, loaded once and looked up by a hash map. Candidates for
+    /// identical traces are confirmed by comparing the stored trace. Only the last trace with a fingerprint is a candidate,
+    /// it covers the backtrack threads of earlier traces of its schedule (see trace_file::find_stored).
+    /// A trace of a different schedule with the same fingerprint is stored again.
+    /// </summary>
+    class fingerprint_index
+    {
+        std::wstring path;
+        std::vector<std::uint64_t> fingerprints;
+        std::unordered_map<std::uint64_t, std::size_t> last_traces;
+
+    public:
+        explicit fingerprint_index(const std::wstring& data_file_path)
+            : path(trace_format::fingerprints_path(data_file_path))
+        {
+            mapped_file file(path);
+            std::uint32_t magic = 0;
+            if (!file || !file.read(0, magic) || magic != trace_format::FINGERPRINTS_MAGIC)
+                return;
+
+            // A partially written fingerprint at the end is ignored
+            fingerprints.resize((file.size() - sizeof(std::uint32_t)) / sizeof(std::uint64_t));
+            last_traces.reserve(fingerprints.size());
+            for (std::size_t i = 0; i < fingerprints.size(); ++i)
+            {
+                file.read(sizeof(std::uint32_t) + i * sizeof(std::uint64_t), fingerprints[i]);
+                last_traces.insert_or_assign(fingerprints[i], i);
+            }
+        }
+
+        [[nodiscard]] std::size_t size() const
+        {
+            return fingerprints.size();
+        }
+
+        /// <summary>
+        /// Adds fingerprints (compute_fingerprint(trace_index)) of traces appended without deduplication.
+        /// Fingerprints are recomputed if there are more of them than traces (the data file was replaced).
+        /// </summary>
+        template<typename ComputeFingerprint>
+        bool sync(std::size_t traces_count, ComputeFingerprint compute_fingerprint)
+        {
+            if (fingerprints.size() == traces_count)
+                return true;
+
+            std::size_t first_missing = fingerprints.size() < traces_count ? fingerprints.size() : 0;
+            if (first_missing == 0)
+                last_traces.clear();
+            fingerprints.resize(first_missing);
+            for (std::size_t i = first_missing; i < traces_count; ++i)
+            {
+                fingerprints.push_back(compute_fingerprint(i));
+                last_traces.insert_or_assign(fingerprints.back(), i);
+            }
+            return store(first_missing);
+        }
+
+        /// <summary>
+        /// Returns index of the last trace with given fingerprint.
+        /// </summary>
+        [[nodiscard]] std::optional<std::size_t> find(std::uint64_t fingerprint) const
+        {
+            if (auto iter = last_traces.find(fingerprint); iter != last_traces.end())
+                return iter->second;
+            return std::nullopt;
+        }
+
+        bool add(std::uint64_t fingerprint)
+        {
+            fingerprints.push_back(fingerprint);
+            last_traces.insert_or_assign(fingerprint, fingerprints.size() - 1);
+            return store(fingerprints.size() - 1);
+        }
+
+    private:
+        /// <summary>
+        /// Stores fingerprints starting at first with a single write, the whole file is rewritten if first is 0.
+        /// </summary>
+        bool store(std::size_t first)
+        {
+            binary_buffer buffer((fingerprints.size() - first + 1) * sizeof(std::uint64_t));
+            if (first == 0)
+                buffer << trace_format::FINGERPRINTS_MAGIC;
+            buffer.write(std::span<const std::uint64_t>(fingerprints).subspan(first));
+
+            binary_fstream file = first == 0 ? binary_fstream(path, binary_fstream::output) : binary_fstream(path, binary_fstream::append);
+            file.seek(static_cast<std::streamoff>(first == 0 ? 0 : sizeof(std::uint32_t) + first * sizeof(std::uint64_t)));
+            file.write(buffer.bytes());
+            return static_cast<bool>(file);
+        }
+    };
+}
@@ -0,0 +1,202 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <ios>
+#include <string>
+#include <string_view>
+#include <limits>
+
+#include "../utils/binary_buffer.hpp"
+#include "../utils/binary_reader.hpp"
+
+/// <summary>
+/// Layout of the binary trace data file.
+///
+/// Version 1 (legacy, no header):
+///   size_t traces_count
+///   blocks of BLOCKS_SIZE streamoff trace offsets followed by streamoff offset of the next block
+///   traces: size_t items_count, items: { size_t counted_id, wstring function_id, size_t options_size }
+///
+/// Version 2:
+///   header: u32 MAGIC, u32 version, streamoff last_commit (0 if no trace was committed yet)
+///   dictionary: size_t strings_count, wstring strings[strings_count]
+///   trace: size_t items_count, items: { size_t counted_id, u32 function_index, size_t options_size }
+///   commit: streamoff previous_commit, streamoff trace_offset, streamoff dictionary_offset, size_t traces_count
+///
+///   Every appended trace is followed by its commit, the header is updated last, so a trace is either fully
+///   written or not visible at all. The dictionary is written again (as a whole) only when the trace introduces
+///   new function ids, commits point to the latest dictionary, so readers need only the last one.
+///
+/// Version 3 (same structure as version 2 with widths independent of the build, values are little-endian):
+///   header: u32 MAGIC, u32 version, u64 last_commit
+///   dictionary: u64 bytes_size, varint strings_count, strings: { varint code_units, UTF-16LE code units }
+///   trace: varint items_count, items: { zigzag varint counted_id delta, varint function_index, zigzag varint options_size delta }
+///   commit: u64 previous_commit, u64 trace_offset, u64 dictionary_offset, u64 traces_count
+///
+///   Deltas are taken from the previous item of the same trace (the first item from 0), consecutive items mostly
+///   belong to the same few threads, so a typical item takes 3 bytes instead of 20.
+///
+/// Version 4 (same as version 3, items also store the backtrack set of the decision, see dpor::reduce_options):
+///   trace: varint items_count, items: { zigzag varint counted_id delta, varint function_index, zigzag varint options_size delta, varint backtrack }
+///
+///   Backtrack is the mask of counted ids of the threads worth running at the decision, 0 if unknown (the reduction was off
+///   or some thread had counted id of dpor::MAX_THREADS or more). Call graphs merge the sets of all traces through a vertex.
+///
+/// Version 5 (same as version 4, items also store the sleep set of the decision, see systematic_driver sleep_sets):
+///   trace: varint items_count, items: { zigzag varint counted_id delta, varint function_index, zigzag varint options_size delta, varint backtrack, varint asleep }
+///
+///   Asleep is the mask of counted ids of the frozen threads whose step was explored from an equivalent state, 0 if none
+///   (or the reduction was off). They stay in options_size, call graphs merge the masks and do not count them as unexplored.
+///
+/// Hit counts (optional sidecar file 'data_file.hits', written when identical traces are merged):
+///   u32 HITS_MAGIC, u64 hits[traces_count]
+///   Number of recorded runs every trace stands for, traces without the sidecar (or beyond its end) stand for a single run.
+///
+/// Fingerprints (optional sidecar file 'data_file.fingerprints', written when appended traces are deduplicated and by TraceFileMerge):
+///   u32 FINGERPRINTS_MAGIC, u64 fingerprints[traces_count] (see fingerprint)
+///   Fingerprints of traces appended without deduplication are added by the next deduplicated append.
+/// </summary>
+namespace trace_format
+{
+    enum class version_t : std::uint32_t
+    {
+        V1 = 1,
+        V2 = 2,
+        V3 = 3,
+        V4 = 4,
+        V5 = 5,
+    };
+
+    static constexpr std::uint32_t MAGIC = 0x52544654; // "TFTR"
+    static constexpr std::uint32_t HITS_MAGIC = 0x53544854; // "THTS"
+    static constexpr std::uint32_t FINGERPRINTS_MAGIC = 0x50464654; // "TFFP"
+    static constexpr version_t CURRENT_VERSION = version_t::V5;
+
+    static constexpr std::size_t BLOCKS_SIZE = 256;
+
+    static constexpr std::streamoff HEADER_SIZE = 2 * sizeof(std::uint32_t) + sizeof(std::streamoff);
+    static constexpr std::streamoff LAST_COMMIT_OFFSET = 2 * sizeof(std::uint32_t);
+
+    static constexpr std::size_t V2_ITEM_SIZE = 2 * sizeof(std::size_t) + sizeof(std::uint32_t);
+
+    struct commit_record
+    {
+        std::streamoff previous_commit;
+        std::streamoff trace_offset;
+        std::streamoff dictionary_offset;
+        std::size_t traces_count;
+    };
+
+    /// <summary>
+    /// Version 3, 4 and 5 item encoding, keeps the previous item of the trace being written or read.
+    /// Version 3 items have no backtrack set, version 3 and 4 items have no sleep set, they are read as 0 and not written.
+    /// </summary>
+    class item_codec
+    {
+        bool has_backtrack;
+        bool has_asleep;
+        std::uint64_t counted_id = 0;
+        std::uint64_t options_size = 0;
+
+    public:
+        explicit item_codec(version_t version)
+            : has_backtrack(version >= version_t::V4), has_asleep(version >= version_t::V5)
+        {
+        }
+
+        void write(binary_buffer& buffer, std::size_t item_counted_id, std::uint32_t function_index, std::size_t item_options_size, std::uint64_t backtrack,
+            std::uint64_t asleep)
+        {
+            buffer.write_varint(byte_order::zigzag_encode(static_cast<std::int64_t>(item_counted_id - counted_id)))
+                .write_varint(function_index)
+                .write_varint(byte_order::zigzag_encode(static_cast<std::int64_t>(item_options_size - options_size)));
+            if (has_backtrack)
+                buffer.write_varint(backtrack);
+            if (has_asleep)
+                buffer.write_varint(asleep);
+            counted_id = item_counted_id;
+            options_size = item_options_size;
+        }
+
+        bool read(binary_reader& reader, std::size_t& item_counted_id, std::uint32_t& function_index, std::size_t& item_options_size, std::uint64_t& backtrack,
+            std::uint64_t& asleep)
+        {
+            std::uint64_t counted_id_delta = 0, options_size_delta = 0;
+            backtrack = 0;
+            asleep = 0;
+            if (!reader.read_varint(counted_id_delta) || !reader.read_varint(function_index) || !reader.read_varint(options_size_delta)
+                || (has_backtrack && !reader.read_varint(backtrack)) || (has_asleep && !reader.read_varint(asleep)))
+                return false;
+
+            counted_id += static_cast<std::uint64_t>(byte_order::zigzag_decode(counted_id_delta));
+            options_size += static_cast<std::uint64_t>(byte_order::zigzag_decode(options_size_delta));
+            if (counted_id > std::numeric_limits<std::size_t>::max() || options_size > std::numeric_limits<std::size_t>::max())
+                return false;
+
+            item_counted_id = static_cast<std::size_t>(counted_id);
+            item_options_size = static_cast<std::size_t>(options_size);
+            return true;
+        }
+    };
+
+    /// <summary>
+    /// Fingerprint of a trace stored in the fingerprints sidecar, FNV-1a over counted_id and UTF-16 code units
+    /// of function_id of every item (the equality of past_trace_item), unlike std::hash it does not depend on the build.
+    /// </summary>
+    class fingerprint
+    {
+        std::uint64_t value = 0xCBF29CE484222325;
+
+    public:
+        void add(std::size_t counted_id, std::wstring_view function_id)
+        {
+            add_value(static_cast<std::uint64_t>(counted_id));
+            for (wchar_t ch : function_id)
+            {
+                auto code_point = static_cast<std::uint32_t>(ch);
+                if (code_point > 0xFFFF)
+                {
+                    code_point -= 0x10000;
+                    add_value(static_cast<std::uint16_t>(0xD800 + (code_point >> 10)));
+                    code_point = 0xDC00 + (code_point & 0x3FF);
+                }
+                add_value(static_cast<std::uint16_t>(code_point));
+            }
+            // function ids never contain 0, it separates the items
+            add_value(std::uint16_t{ 0 });
+        }
+
+        [[nodiscard]] std::uint64_t get() const
+        {
+            return value;
+        }
+
+    private:
+        template<typename T>
+        void add_value(T data)
+        {
+            for (std::size_t i = 0; i < sizeof(T); ++i)
+                value = (value ^ static_cast<std::uint8_t>(data >> (8 * i))) * 0x100000001B3;
+        }
+    };
+
+    inline std::wstring hits_path(const std::wstring& data_file_path)
+    {
+        return data_file_path + L".hits";
+    }
+
+    inline std::wstring fingerprints_path(const std::wstring& data_file_path)
+    {
+        return data_file_path + L".fingerprints";
+    }
+
+    /// <summary>
+    /// Version 1 files start directly with traces count, no realistic count matches the magic.
+    /// </summary>
+    inline version_t detect_version(std::uint32_t first_word, std::uint32_t second_word)
+    {
+        if (first_word == MAGIC)
+            return static_cast<version_t>(second_word);
+        return version_t::V1;
+    }
+}
@@ -0,0 +1,406 @@
+#pragma once
+
+#include "trace.hpp"
+#include "dpor.hpp"
+#include "thread_info.hpp"
+
+#include "../cor_error_handling.hpp"
+#include "../utils/mapped_file.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <thread>
+#include <mutex>
+#include <vector>
+#include <string>
+#include <filesystem>
+#include <unordered_map>
+#include <memory_resource>
+
+#include <Windows.h>
+
+/// <summary>
+/// Streams the trace of the current run into a journal next to the data file, so the trace is not lost when the
+/// process ends early (thread_preemption_bound_strategy::EXIT, killed on timeout).
+///
+/// Controller loop serializes items into a bounded ring buffer, a background writer flushes it to the journal.
+/// Neither of them allocates after construction, as the application threads might be suspended while holding the heap lock.
+/// Entries become visible to the writer only once complete, so the journal is only ever torn by the process termination.
+///
+/// Journal: u32 JOURNAL_MAGIC, u32 version, followed by entries (u8 tag + payload)
+///   FUNCTION: u32 function_index, size_t length, wchar_t[length]
+///   ITEM:     size_t counted_id, u32 function_index, size_t options_size, u64 object, u64 frozen_threads (see dpor::step), u64 asleep
+///   END:      the run finished, the trace is complete
+/// Entries torn by the process termination are ignored.
+/// The recovered trace is reduced as its run would reduce it (see dpor::reduce_options), the reduction is on if frozen threads are known.
+///
+/// Once the trace is committed to the data file, the journal is removed. A journal left behind is committed or
+/// discarded by the next run, see <see cref="recover"/>. The journal is open for writing as long as its run lives,
+/// so other workers recover only journals of finished runs.
+/// </summary>
+class trace_journal
+{
+    enum class entry_tag : std::uint8_t
+    {
+        FUNCTION = 1,
+        ITEM = 2,
+        END = 3,
+    };
+
+    static constexpr std::uint32_t JOURNAL_MAGIC = 0x524A4654; // "TFJR"
+    static constexpr std::uint32_t JOURNAL_VERSION = 3;
+    static constexpr std::size_t RING_CAPACITY = 64 * 1024; // power of two
+    static constexpr std::chrono::milliseconds FLUSH_INTERVAL{ 10 };
+
+    std::wstring path;
+    HANDLE file_handle;
+
+    std::pmr::memory_resource* mem_resource;
+    std::pmr::unordered_map<const function_spec*, std::uint32_t> function_indices;
+
+    // single producer (controller loop), consumers serialized by flush_mtx
+    // Producer writes the entry past the head and publishes the head once the entry is complete (staged_head)
+    std::pmr::vector<char> ring;
+    std::atomic<std::size_t> head;
+    std::atomic<std::size_t> tail;
+    std::size_t staged_head;
+    std::atomic<bool> adding;
+    std::mutex flush_mtx;
+    bool completed;
+
+    std::atomic<bool> stop_writer;
+    std::thread writer;
+
+public:
+    enum class recovery_result : std::uint8_t
+    {
+        NONE,
+        COMMITTED,
+        COMMITTED_PARTIAL,
+        DISCARDED,
+        IN_USE, // the run writing the journal is alive, or another process is recovering it
+    };
+
+    static std::wstring journal_path(const std::wstring& data_file_path)
+    {
+        return data_file_path + L".journal";
+    }
+
+    trace_journal(const std::wstring& data_file_path, std::pmr::memory_resource* mem_resource)
+        : path(journal_path(data_file_path))
+        , file_handle(CreateFile(path.c_str(), GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_DELETE, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr))
+        , mem_resource(mem_resource), function_indices(mem_resource)
+        , ring(RING_CAPACITY, mem_resource), head(0), tail(0), staged_head(0), adding(false), completed(false)
+        , stop_writer(false)
+    {
+        if (file_handle == INVALID_HANDLE_VALUE)
+            throw profiler_error(L"Cannot create trace journal " + path);
+
+        function_indices.reserve(1024);
+
+        push(JOURNAL_MAGIC);
+        push(JOURNAL_VERSION);
+        publish();
+        flush();
+
+        writer = std::thread([this]
+        {
+            while (!stop_writer)
+            {
+                std::this_thread::sleep_for(FLUSH_INTERVAL);
+                flush();
+            }
+        });
+        SetThreadDescription(writer.native_handle(), L"TraceJournalWriter");
+    }
+
+    trace_journal(const trace_journal&) = delete;
+    trace_journal(trace_journal&&) = delete;
+    trace_journal& operator=(const trace_journal&) = delete;
+    trace_journal& operator=(trace_journal&&) = delete;
+
+    ~trace_journal()
+    {
+        stop();
+        if (file_handle != INVALID_HANDLE_VALUE)
+            CloseHandle(file_handle);
+    }
+
+    /// <summary>
+    /// Mirrors <see cref="trace::add"/>, called only from the controller loop.
+    /// </summary>
+    void add(const std::pmr::vector<thread_info*>& thr_infos, std::size_t total_options_size, std::uint64_t frozen_threads = 0, std::uint64_t asleep = 0)
+    {
+        // flush(true) waits for the whole decision
+        adding.store(true, std::memory_order_seq_cst);
+
+        for (const thread_info* thr_info : thr_infos)
+        {
+            if (!thr_info->call_stack)
+                continue;
+
+            const function_spec* function = thr_info->call_stack->back();
+            auto [iter, inserted] = function_indices.try_emplace(function, static_cast<std::uint32_t>(function_indices.size()));
+            if (inserted)
+            {
+                const auto& function_id = function->get_pretty_info(mem_resource);
+                push(entry_tag::FUNCTION);
+                push(iter->second);
+                push(function_id.size());
+                push_bytes(function_id.data(), function_id.size() * sizeof(wchar_t));
+                publish();
+            }
+
+            push(entry_tag::ITEM);
+            push(thr_info->get_thread_id().counted_id);
+            push(iter->second);
+            push(total_options_size);
+            push(static_cast<std::uint64_t>(reinterpret_cast<std::uintptr_t>(thr_info->current_object())));
+            push(frozen_threads);
+            push(asleep);
+            publish();
+        }
+
+        adding.store(false, std::memory_order_release);
+    }
+
+    /// <summary>
+    /// Writes every complete entry buffered so far to the journal, can be called from any thread.
+    /// With trace_complete it first waits until the controller loop finishes the decision it is adding and marks
+    /// the journal as complete, anything added afterwards is ignored by the recovery.
+    /// </summary>
+    void flush(bool trace_complete = false)
+    {
+        if (trace_complete)
+        {
+            // The ring is drained meanwhile, the controller loop might wait for space
+            while (adding.load(std::memory_order_acquire))
+            {
+                {
+                    std::lock_guard guard(flush_mtx);
+                    write_entries();
+                }
+                std::this_thread::yield();
+            }
+        }
+
+        std::lock_guard guard(flush_mtx);
+        write_entries();
+
+        if (trace_complete && !completed)
+        {
+            auto tag = entry_tag::END;
+            DWORD written = 0;
+            WriteFile(file_handle, &tag, sizeof(tag), &written, nullptr);
+            completed = true;
+        }
+    }
+
+    /// <summary>
+    /// Stops the background writer and marks the trace as complete.
+    /// </summary>
+    void finish()
+    {
+        stop();
+        flush(true);
+    }
+
+    /// <summary>
+    /// Removes the journal, once the trace is committed to the data file.
+    /// It is deleted before it is closed, no other worker can take it for a journal of a finished run meanwhile.
+    /// </summary>
+    void remove()
+    {
+        stop();
+
+        std::error_code ec;
+        std::filesystem::remove(path, ec);
+
+        if (file_handle != INVALID_HANDLE_VALUE)
+        {
+            CloseHandle(file_handle);
+            file_handle = INVALID_HANDLE_VALUE;
+        }
+    }
+
+    /// <summary>
+    /// Handles the journal left behind by a previous run. Complete trace is always appended to the data file,
+    /// partial trace only if keep_partial is set (otherwise it is discarded). The journal is removed afterwards,
+    /// unless the trace cannot be appended: the journal is kept then and profiler_error is thrown.
+    /// With deduplicate, an already stored trace (in the data file or in other_files) only gets a hit (see trace_file::set_deduplication).
+    /// The journal is held open for writing meanwhile, journal of a live run or of a concurrent recovery is left as it is (IN_USE).
+    /// </summary>
+    static recovery_result recover(const std::wstring& data_file_path, bool keep_partial, bool deduplicate, std::vector<std::wstring> other_files)
+    {
+        auto path = journal_path(data_file_path);
+        std::error_code ec;
+        if (!std::filesystem::exists(path, ec))
+            return recovery_result::NONE;
+
+        // Fails while the writer of the journal or another recovery has it open
+        HANDLE claim = CreateFile(path.c_str(), GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_DELETE, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (claim == INVALID_HANDLE_VALUE)
+            return GetLastError() == ERROR_FILE_NOT_FOUND ? recovery_result::NONE : recovery_result::IN_USE;
+
+        recovery_result result = recovery_result::DISCARDED;
+        {
+            std::vector<past_trace_item> past_trace;
+            std::vector<dpor::step> steps;
+            bool complete = read_journal(path, past_trace, steps);
+
+            if (!past_trace.empty() && (complete || keep_partial))
+            {
+                dpor::reduce_options(past_trace, steps, std::pmr::get_default_resource());
+
+                trace_file data_file(data_file_path);
+                data_file.set_deduplication(deduplicate, std::move(other_files));
+                data_file.append_trace(past_trace);
+                if (!data_file)
+                {
+                    CloseHandle(claim);
+                    throw profiler_error(L"Cannot commit trace journal to " + data_file_path + L", the journal is kept for the next run");
+                }
+                result = complete ? recovery_result::COMMITTED : recovery_result::COMMITTED_PARTIAL;
+            }
+        }
+
+        // Deleted before the claim is closed, like in remove
+        std::filesystem::remove(path, ec);
+        CloseHandle(claim);
+        return result;
+    }
+
+private:
+    void stop()
+    {
+        stop_writer = true;
+        if (writer.joinable())
+            writer.join();
+    }
+
+    /// <summary>
+    /// Writes the published entries, flush_mtx must be held.
+    /// </summary>
+    void write_entries()
+    {
+        std::size_t cur_tail = tail.load(std::memory_order_relaxed);
+        std::size_t cur_head = head.load(std::memory_order_acquire);
+        while (cur_tail != cur_head)
+        {
+            std::size_t start = cur_tail % RING_CAPACITY;
+            std::size_t length = std::min(cur_head - cur_tail, RING_CAPACITY - start);
+
+            DWORD written = 0;
+            if (!WriteFile(file_handle, ring.data() + start, static_cast<DWORD>(length), &written, nullptr) || written == 0)
+                break;
+
+            cur_tail += written;
+            tail.store(cur_tail, std::memory_order_release);
+        }
+    }
+
+    template<typename T>
+    void push(const T& value)
+    {
+        push_bytes(&value, sizeof(T));
+    }
+
+    void push_bytes(const void* ptr, std::size_t size)
+    {
+        const auto* bytes = static_cast<const char*>(ptr);
+
+        while (size > 0)
+        {
+            // Bounded buffer, wait for the writer to make some space
+            std::size_t free_space = RING_CAPACITY - (staged_head - tail.load(std::memory_order_acquire));
+            if (free_space == 0)
+            {
+                // Entry longer than the ring is published in parts, flush(true) still waits for the rest of it
+                if (head.load(std::memory_order_relaxed) == tail.load(std::memory_order_acquire))
+                    publish();
+                std::this_thread::yield();
+                continue;
+            }
+
+            std::size_t start = staged_head % RING_CAPACITY;
+            std::size_t length = std::min({ size, free_space, RING_CAPACITY - start });
+            std::memcpy(ring.data() + start, bytes, length);
+
+            bytes += length;
+            size -= length;
+            staged_head += length;
+        }
+    }
+
+    /// <summary>
+    /// Makes the entries pushed so far visible to the writer.
+    /// </summary>
+    void publish()
+    {
+        head.store(staged_head, std::memory_order_release);
+    }
+
+    /// <summary>
+    /// Reads the items of the journal and their steps, returns true if the trace is complete.
+    /// </summary>
+    static bool read_journal(const std::wstring& path, std::vector<past_trace_item>& past_trace, std::vector<dpor::step>& steps)
+    {
+        mapped_file journal(path);
+
+        std::uint32_t magic = 0, version = 0;
+        if (!journal.read(0, magic) || !journal.read(sizeof(std::uint32_t), version) || magic != JOURNAL_MAGIC || version != JOURNAL_VERSION)
+            return false;
+
+        std::vector<function_table::key_t> functions;
+        std::size_t offset = 2 * sizeof(std::uint32_t);
+        entry_tag tag;
+        while (journal.read(offset, tag))
+        {
+            offset += sizeof(entry_tag);
+
+            if (tag == entry_tag::END)
+                return true;
+
+            if (tag == entry_tag::FUNCTION)
+            {
+                std::uint32_t index;
+                std::size_t length;
+                if (!journal.read(offset, index) || !journal.read(offset + sizeof(std::uint32_t), length) || index != functions.size())
+                    break;
+                offset += sizeof(std::uint32_t) + sizeof(std::size_t);
+
+                if (length > (journal.size() - offset) / sizeof(wchar_t))
+                    break;
+                std::wstring function_id(length, L'\0');
+                std::memcpy(function_id.data(), journal.data().data() + offset, length * sizeof(wchar_t));
+                functions.push_back(function_table::get_instance().intern(function_id));
+                offset += length * sizeof(wchar_t);
+            }
+            else if (tag == entry_tag::ITEM)
+            {
+                past_trace_item item;
+                std::uint32_t function_index;
+                std::uint64_t object, frozen_threads;
+                if (!journal.read(offset, item.counted_id)
+                    || !journal.read(offset + sizeof(std::size_t), function_index)
+                    || !journal.read(offset + sizeof(std::size_t) + sizeof(std::uint32_t), item.options_size)
+                    || !journal.read(offset + 2 * sizeof(std::size_t) + sizeof(std::uint32_t), object)
+                    || !journal.read(offset + 2 * sizeof(std::size_t) + sizeof(std::uint32_t) + sizeof(std::uint64_t), frozen_threads)
+                    || !journal.read(offset + 2 * sizeof(std::size_t) + sizeof(std::uint32_t) + 2 * sizeof(std::uint64_t), item.asleep)
+                    || function_index >= functions.size())
+                    break;
+                offset += 2 * sizeof(std::size_t) + sizeof(std::uint32_t) + 3 * sizeof(std::uint64_t);
+
+                item.function_key = functions[function_index];
+                past_trace.push_back(std::move(item));
+                steps.push_back({ past_trace.back().counted_id, reinterpret_cast<net_reference>(static_cast<std::uintptr_t>(object)), frozen_threads });
+            }
+            else
+                break;
+        }
+
+        // torn or missing END entry
+        return false;
+    }
+};
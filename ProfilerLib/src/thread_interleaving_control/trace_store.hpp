@@ -0,0 +1,258 @@
+#pragma once
+
+#include "call_graph_builder.hpp"
+#include "trace.hpp"
+
+#include "../config_file.hpp"
+#include "../utils/mapped_file.hpp"
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <algorithm>
+#include <filesystem>
+
+#include <Windows.h>
+
+/// <summary>
+/// Data file split into segments, so several profiled processes can record traces at the same time.
+///
+///   data_file                       base segment (traces recorded without segments), optional
+///   data_file.manifest              file names of the other segments, one per line (UTF-16)
+///   data_file.(worker).segment      traces of a single worker, regular trace file appended only by that worker
+///
+/// Worker registers its segment in the manifest with a single append, so no locking is needed.
+/// Readers see the base segment followed by the segments in the manifest order as one logical file.
+/// Workers are named by the runner, so a new run reuses the segment (and the journal, see trace_journal) of its slot.
+/// </summary>
+namespace trace_store
+{
+    inline std::wstring manifest_path(const std::wstring& data_file_path)
+    {
+        return data_file_path + L".manifest";
+    }
+
+    inline std::wstring segment_file_name(const std::wstring& data_file_path, const std::wstring& worker)
+    {
+        return std::filesystem::path(data_file_path).filename().wstring() + L"." + worker + L".segment";
+    }
+
+    /// <summary>
+    /// Segments are enabled by 'data_file_segments = on'. Worker is identified by THREADFUZZER_WORKER environment
+    /// variable (e.g. index of the parallel slot in the runner), it is required then.
+    /// </summary>
+    inline bool segments_enabled()
+    {
+        return config_file::get_instance().get_value(L"data_file_segments") == L"on";
+    }
+
+    /// <summary>
+    /// Returns THREADFUZZER_WORKER, a name per process (e.g. process id) would add a segment and a journal with every run.
+    /// </summary>
+    inline std::wstring worker_name()
+    {
+        wchar_t buffer[64];
+        DWORD length = GetEnvironmentVariable(L"THREADFUZZER_WORKER", buffer, static_cast<DWORD>(std::size(buffer)));
+        if (length == 0 || length >= std::size(buffer))
+            throw profiler_error(L"data_file_segments = on requires THREADFUZZER_WORKER environment variable (slot of the worker, up to 63 characters)");
+
+        std::wstring name(buffer, length);
+        if (name.find_first_of(L"\\/:*?\"<>|") != std::wstring::npos)
+            throw profiler_error(L"THREADFUZZER_WORKER must be a valid file name part: " + name);
+        return name;
+    }
+
+    /// <summary>
+    /// Returns file names listed in the manifest, empty if there is no manifest.
+    /// </summary>
+    inline std::vector<std::wstring> read_manifest(const std::wstring& data_file_path)
+    {
+        std::vector<std::wstring> names;
+
+        mapped_file manifest(manifest_path(data_file_path));
+        if (!manifest || manifest.size() == 0)
+            return names;
+
+        std::wstring_view content(reinterpret_cast<const wchar_t*>(manifest.data().data()), manifest.size() / sizeof(wchar_t));
+        while (!content.empty())
+        {
+            auto end = content.find(L'\n');
+            if (end == std::wstring_view::npos)
+                break; // torn line
+
+            auto name = content.substr(0, end);
+            if (!name.empty() && std::ranges::find(names, name) == names.end())
+                names.emplace_back(name);
+            content.remove_prefix(end + 1);
+        }
+
+        return names;
+    }
+
+    /// <summary>
+    /// Returns paths of all existing segments in reading order, the base segment first.
+    /// </summary>
+    inline std::vector<std::wstring> segment_paths(const std::wstring& data_file_path)
+    {
+        std::vector<std::wstring> paths;
+
+        std::error_code ec;
+        if (std::filesystem::exists(data_file_path, ec))
+            paths.push_back(data_file_path);
+
+        auto directory = std::filesystem::path(data_file_path).parent_path();
+        for (const auto& name : read_manifest(data_file_path))
+        {
+            auto path = (directory / name).wstring();
+            if (std::filesystem::exists(path, ec))
+                paths.push_back(std::move(path));
+        }
+
+        return paths;
+    }
+
+    /// <summary>
+    /// Returns paths of the existing segments other than the one at record_path, identical traces are looked up in them
+    /// before a trace is appended (see trace_file::set_deduplication).
+    /// </summary>
+    inline std::vector<std::wstring> other_segment_paths(const std::wstring& data_file_path, const std::wstring& record_path)
+    {
+        auto paths = segment_paths(data_file_path);
+        std::erase(paths, record_path);
+        return paths;
+    }
+
+    /// <summary>
+    /// Returns path of the file the current process should append its traces to.
+    /// With segments enabled, it is the segment of this worker, which is created and registered in the manifest if needed.
+    /// </summary>
+    inline std::wstring record_path(const std::wstring& data_file_path)
+    {
+        if (!segments_enabled())
+            return data_file_path;
+
+        auto name = segment_file_name(data_file_path, worker_name());
+        auto path = (std::filesystem::path(data_file_path).parent_path() / name).wstring();
+
+        if (!trace_file(path)) // creates the segment
+            throw profiler_error(L"Invalid data_file segment " + path);
+
+        auto registered = read_manifest(data_file_path);
+        if (std::ranges::find(registered, name) == registered.end())
+        {
+            HANDLE manifest = CreateFile(manifest_path(data_file_path).c_str(), FILE_APPEND_DATA, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+            if (manifest == INVALID_HANDLE_VALUE)
+                throw profiler_error(L"Cannot open data_file manifest");
+
+            // Single append of the whole line, concurrent registrations do not interleave
+            auto line = name + L"\n";
+            DWORD written = 0;
+            BOOL ok = WriteFile(manifest, line.data(), static_cast<DWORD>(line.size() * sizeof(wchar_t)), &written, nullptr);
+            CloseHandle(manifest);
+
+            if (!ok || written != line.size() * sizeof(wchar_t))
+                throw profiler_error(L"Cannot register data_file segment " + path);
+        }
+
+        return path;
+    }
+}
+
+/// <summary>
+/// All segments of the data file mapped into memory, read as a single <see cref="mapped_trace_file"/>.
+/// Traces are numbered in the reading order of <see cref="trace_store::segment_paths"/>.
+/// </summary>
+class mapped_trace_store
+{
+    std::vector<mapped_trace_file> segments;
+    std::vector<std::size_t> first_traces;
+    std::size_t traces_count;
+    bool valid;
+
+public:
+    explicit mapped_trace_store(const std::wstring& data_file_path)
+        : traces_count(0), valid(true)
+    {
+        auto paths = trace_store::segment_paths(data_file_path);
+        segments.reserve(paths.size());
+        first_traces.reserve(paths.size());
+
+        for (const auto& path : paths)
+        {
+            const auto& segment = segments.emplace_back(path);
+            valid = valid && static_cast<bool>(segment);
+
+            first_traces.push_back(traces_count);
+            traces_count += segment.traces_size();
+        }
+    }
+
+    [[nodiscard]] std::size_t traces_size() const
+    {
+        return traces_count;
+    }
+
+    [[nodiscard]] std::size_t segments_size() const
+    {
+        return segments.size();
+    }
+
+    [[nodiscard]] const mapped_trace_file& get_segment(std::size_t index) const
+    {
+        return segments.at(index);
+    }
+
+    template<typename F>
+    void for_each_item(std::size_t index, F f) const
+    {
+        auto [segment, local_index] = locate(index);
+        segment.for_each_item(local_index, f);
+    }
+
+    template<typename Alloc>
+    void get_trace(std::size_t index, std::vector<past_trace_item, Alloc>& past_traces) const
+    {
+        auto [segment, local_index] = locate(index);
+        segment.get_trace(local_index, past_traces);
+    }
+
+    /// <summary>
+    /// Adds traces of all segments on several threads (<see cref="call_graph_builder"/>), values are computed once at the end.
+    /// </summary>
+    void populate_call_graph(pmr::tree_graph<int, past_trace_item>& call_graph, std::pmr::memory_resource* mem_res) const
+    {
+        call_graph_builder::add_paths(*this, call_graph, mem_res);
+        call_graph_utils::compute_values(call_graph);
+    }
+
+    void populate_call_graph(tree_graph<int, past_trace_item>& call_graph) const
+    {
+        call_graph_builder::add_paths(*this, call_graph, std::pmr::get_default_resource());
+        call_graph_utils::compute_values(call_graph);
+    }
+
+    /// <summary>
+    /// Returns true if all segments are valid, missing data file is an empty store.
+    /// </summary>
+    explicit operator bool() const
+    {
+        return valid;
+    }
+
+    bool operator!() const
+    {
+        return !valid;
+    }
+
+private:
+    [[nodiscard]] std::pair<const mapped_trace_file&, std::size_t> locate(std::size_t index) const
+    {
+        if (index >= traces_count)
+            throw profiler_error(L"Trace " + std::to_wstring(index) + L" out of range");
+
+        // Empty segments share the first trace with the next one, upper_bound skips them
+        auto segment_index = static_cast<std::size_t>(std::ranges::upper_bound(first_traces, index) - first_traces.begin()) - 1;
+
+        return { segments[segment_index], index - first_traces[segment_index] };
+    }
+};
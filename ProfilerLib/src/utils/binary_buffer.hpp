@@ -0,0 +1,131 @@
+#pragma once
+#include "binary_fstream.hpp"
+#include "byte_order.hpp"
+
+#include <vector>
+#include <string>
+#include <string_view>
+#include <span>
+#include <memory_resource>
+
+/// <summary>
+/// In-memory counterpart of <see cref="binary_fstream"/> output, uses the same encoding (see <see cref="byte_order"/>).
+/// Allows to serialize a whole record and store it with single <see cref="binary_fstream::write"/>.
+/// </summary>
+class binary_buffer
+{
+    std::pmr::vector<char> buffer;
+
+public:
+    binary_buffer() = default;
+
+    explicit binary_buffer(std::size_t capacity, std::pmr::memory_resource* mem_res = std::pmr::get_default_resource())
+        : buffer(mem_res)
+    {
+        buffer.reserve(capacity);
+    }
+
+    template<Arithmetic V>
+    binary_buffer& operator<<(const V& value)
+    {
+        byte_order::store(grow(sizeof(V)), value);
+        return *this;
+    }
+
+    template<typename CharT, typename Alloc>
+    binary_buffer& operator<<(const std::basic_string<CharT, std::char_traits<CharT>, Alloc>& str)
+    {
+        return write_string(str.data(), str.size());
+    }
+
+    binary_buffer& operator<<(std::wstring_view str)
+    {
+        return write_string(str.data(), str.size());
+    }
+
+    template<typename T, typename Alloc>
+    binary_buffer& operator<<(const std::vector<T, Alloc>& vec)
+    {
+        *this << vec.size();
+        if constexpr (byte_order::is_bulk_copyable<T>)
+            write(std::span<const T>(vec));
+        else
+        {
+            for (const auto& item : vec)
+                *this << item;
+        }
+        return *this;
+    }
+
+    /// <summary>
+    /// Appends contiguous arithmetic values (without size), a single copy on little-endian targets.
+    /// </summary>
+    template<Arithmetic T>
+    binary_buffer& write(std::span<const T> values)
+    {
+        char* dst = grow(values.size_bytes());
+        if constexpr (byte_order::is_bulk_copyable<T>)
+            std::memcpy(dst, values.data(), values.size_bytes());
+        else
+        {
+            for (const T& value : values)
+            {
+                byte_order::store(dst, value);
+                dst += sizeof(T);
+            }
+        }
+        return *this;
+    }
+
+    /// <summary>
+    /// Appends unsigned value as LEB128 varint, values below 128 take a single byte.
+    /// </summary>
+    binary_buffer& write_varint(std::uint64_t value)
+    {
+        byte_order::store_varint(grow(byte_order::varint_size(value)), value);
+        return *this;
+    }
+
+    /// <summary>
+    /// Appends string as varint count of code units followed by UTF-16LE code units.
+    /// </summary>
+    binary_buffer& write_varint_string(std::wstring_view str)
+    {
+        std::size_t code_units = byte_order::utf16_size(str.data(), str.size());
+        write_varint(code_units);
+        byte_order::store_utf16(grow(code_units * sizeof(char16_t)), str.data(), str.size());
+        return *this;
+    }
+
+    [[nodiscard]] std::size_t size() const
+    {
+        return buffer.size();
+    }
+
+    [[nodiscard]] std::span<const char> bytes() const
+    {
+        return buffer;
+    }
+
+    void clear()
+    {
+        buffer.clear();
+    }
+
+private:
+    template<typename CharT>
+    binary_buffer& write_string(const CharT* str, std::size_t size)
+    {
+        std::size_t code_units = byte_order::utf16_size(str, size);
+        *this << code_units;
+        byte_order::store_utf16(grow(code_units * sizeof(char16_t)), str, size);
+        return *this;
+    }
+
+    char* grow(std::size_t size)
+    {
+        std::size_t offset = buffer.size();
+        buffer.resize(offset + size);
+        return buffer.data() + offset;
+    }
+};
@@ -4,8 +4,11 @@
 #include <vector>
 #include <string>
 #include <tuple>
+#include <span>
 #include <utility>
 
+#include "byte_order.hpp"
+
 template<typename T>
 concept Arithmetic = std::is_arithmetic_v<T>;
 
@@ -87,25 +90,51 @@ private:
         using ConstOrNotCharPtr = std::conditional_t<std::is_const_v<T>, const char*, char*>;
     };
 
+    // Values are little-endian and strings UTF-16LE, see byte_order
     template<typename Operation, Arithmetic V>
     binary_fstream& process_arithmetic(V& value)
     {
-        Operation::perform_io(stream, reinterpret_cast<detail::ConstOrNotCharPtr<V>>(&value), sizeof(V));
+        if constexpr (byte_order::is_bulk_copyable<std::remove_const_t<V>>)
+            Operation::perform_io(stream, reinterpret_cast<detail::ConstOrNotCharPtr<V>>(&value), sizeof(V));
+        else if constexpr (Operation::is_read)
+        {
+            char bytes[sizeof(V)];
+            Operation::perform_io(stream, bytes, sizeof(V));
+            value = byte_order::load<V>(bytes);
+        }
+        else
+        {
+            char bytes[sizeof(V)];
+            byte_order::store(bytes, value);
+            Operation::perform_io(stream, static_cast<const char*>(bytes), sizeof(V));
+        }
         return *this;
     }
 
     template<typename Operation, typename String>
     binary_fstream& process_string(String& str)
     {
-        std::size_t sz;
+        std::size_t code_units;
         if constexpr (Operation::is_write)
-            sz = str.size();
+            code_units = byte_order::utf16_size(str.data(), str.size());
 
-        if (Operation::perform_op(*this, sz))
+        if (Operation::perform_op(*this, code_units))
         {
-            if constexpr (Operation::is_read)
-                str.resize(sz);
-            Operation::perform_io(stream, detail::ConstOrNotCharPtr<String>(str.data()), static_cast<std::streamsize>(str.size()) * sizeof str[0]);
+            if constexpr (sizeof str[0] == sizeof(char16_t) && byte_order::is_bulk_copyable<char16_t>)
+            {
+                if constexpr (Operation::is_read)
+                    str.resize(code_units);
+                Operation::perform_io(stream, detail::ConstOrNotCharPtr<String>(str.data()), static_cast<std::streamsize>(code_units) * sizeof(char16_t));
+            }
+            else
+            {
+                std::vector<char> bytes(code_units * sizeof(char16_t));
+                if constexpr (Operation::is_write)
+                    byte_order::store_utf16(bytes.data(), str.data(), str.size());
+                Operation::perform_io(stream, detail::ConstOrNotCharPtr<String>(bytes.data()), static_cast<std::streamsize>(bytes.size()));
+                if constexpr (Operation::is_read)
+                    byte_order::load_utf16(str, bytes.data(), code_units);
+            }
         }
         return *this;
     }
@@ -121,9 +150,16 @@ private:
         {
             if constexpr (Operation::is_read)
                 vec.resize(sz);
-            for (auto&& item : vec)
-                if (!Operation::perform_op(*this, item))
-                    break;
+
+            // Contiguous arithmetic values are transferred at once
+            if constexpr (byte_order::is_bulk_copyable<typename std::remove_const_t<Vector>::value_type>)
+                Operation::perform_io(stream, detail::ConstOrNotCharPtr<Vector>(vec.data()), static_cast<std::streamsize>(vec.size()) * sizeof vec[0]);
+            else
+            {
+                for (auto&& item : vec)
+                    if (!Operation::perform_op(*this, item))
+                        break;
+            }
         }
         return *this;
     }
@@ -211,6 +247,24 @@ public:
         return *this;
     }
 
+    /// <summary>
+    /// Writes already serialized bytes (see binary_buffer) with a single stream operation.
+    /// </summary>
+    binary_fstream& write(std::span<const char> bytes)
+    {
+        stream.write(bytes.data(), static_cast<std::streamsize>(bytes.size()));
+        return *this;
+    }
+
+    /// <summary>
+    /// Reads raw bytes (to be parsed by binary_reader) with a single stream operation.
+    /// </summary>
+    binary_fstream& read(std::span<char> bytes)
+    {
+        stream.read(bytes.data(), static_cast<std::streamsize>(bytes.size()));
+        return *this;
+    }
+
 // Miscellaneous
     explicit operator bool() const
     {
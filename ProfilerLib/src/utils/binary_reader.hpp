@@ -0,0 +1,197 @@
+#pragma once
+#include "binary_fstream.hpp"
+#include "byte_order.hpp"
+
+#include <cstddef>
+#include <cstring>
+#include <concepts>
+#include <limits>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/// <summary>
+/// Bounds-checked deserializer over bytes in memory (e.g. <see cref="mapped_file"/>), reads the encoding of <see cref="binary_buffer"/>.
+/// Reads return false and leave the position unchanged if the value does not fit into the remaining bytes.
+/// </summary>
+class binary_reader
+{
+    std::span<const std::byte> data;
+    std::size_t position;
+
+public:
+    explicit binary_reader(std::span<const std::byte> data, std::size_t position = 0)
+        : data(data), position(position)
+    {
+    }
+
+    template<Arithmetic V>
+    bool read(V& value)
+    {
+        if (remaining() < sizeof(V))
+            return false;
+        value = byte_order::load<V>(data.data() + position);
+        position += sizeof(V);
+        return true;
+    }
+
+    /// <summary>
+    /// Reads contiguous arithmetic values (without size), a single copy on little-endian targets.
+    /// </summary>
+    template<Arithmetic T>
+    bool read(std::span<T> values)
+    {
+        if (remaining() / sizeof(T) < values.size())
+            return false;
+        if constexpr (byte_order::is_bulk_copyable<T>)
+            std::memcpy(values.data(), data.data() + position, values.size_bytes());
+        else
+        {
+            for (std::size_t i = 0; i < values.size(); ++i)
+                values[i] = byte_order::load<T>(data.data() + position + i * sizeof(T));
+        }
+        position += values.size_bytes();
+        return true;
+    }
+
+    /// <summary>
+    /// Reads the string into str, keeping its allocator (e.g. std::pmr::wstring).
+    /// </summary>
+    template<typename CharT, typename Alloc>
+    bool read(std::basic_string<CharT, std::char_traits<CharT>, Alloc>& str)
+    {
+        std::size_t start = position;
+        std::size_t code_units = 0;
+        return (read(code_units) && read_code_units(str, code_units)) || rewind(start);
+    }
+
+    /// <summary>
+    /// Reads the string without copying, the view points directly into the data.
+    /// Only available where wide strings are UTF-16 in memory.
+    /// </summary>
+    bool read(std::wstring_view& str)
+    {
+        std::size_t start = position;
+        std::size_t code_units = 0;
+        return (read(code_units) && read_code_units(str, code_units)) || rewind(start);
+    }
+
+    /// <summary>
+    /// Reads LEB128 varint written by <see cref="binary_buffer::write_varint"/>, fails if the value does not fit into V.
+    /// </summary>
+    template<std::unsigned_integral V>
+    bool read_varint(V& value)
+    {
+        std::uint64_t result = 0;
+        std::size_t size = 0;
+        for (unsigned shift = 0;; shift += 7)
+        {
+            if (size == remaining() || shift >= 64)
+                return false;
+
+            auto byte = std::to_integer<std::uint8_t>(data[position + size++]);
+            result |= static_cast<std::uint64_t>(byte & 0x7F) << shift;
+            if ((byte & 0x80) == 0)
+                break;
+        }
+
+        if (result > std::numeric_limits<V>::max())
+            return false;
+        value = static_cast<V>(result);
+        position += size;
+        return true;
+    }
+
+    /// <summary>
+    /// Reads string written by <see cref="binary_buffer::write_varint_string"/> into std::wstring_view or an allocator-aware string.
+    /// </summary>
+    template<typename String>
+    bool read_varint_string(String& str)
+    {
+        std::size_t start = position;
+        std::size_t code_units = 0;
+        return (read_varint(code_units) && read_code_units(str, code_units)) || rewind(start);
+    }
+
+    template<typename T, typename Alloc>
+    bool read(std::vector<T, Alloc>& vec)
+    {
+        std::size_t start = position;
+        std::size_t size = 0;
+        if (!read(size))
+            return false;
+
+        bool ok = true;
+        if constexpr (byte_order::is_bulk_copyable<T>)
+        {
+            ok = remaining() / sizeof(T) >= size;
+            if (ok)
+            {
+                vec.resize(size);
+                ok = read(std::span<T>(vec));
+            }
+        }
+        else
+        {
+            vec.clear();
+            for (std::size_t i = 0; ok && i < size; ++i)
+                ok = read(vec.emplace_back());
+        }
+
+        if (!ok)
+            position = start;
+        return ok;
+    }
+
+    bool skip(std::size_t size)
+    {
+        if (remaining() < size)
+            return false;
+        position += size;
+        return true;
+    }
+
+    void seek(std::size_t new_position)
+    {
+        position = new_position;
+    }
+
+    [[nodiscard]] std::size_t tell() const
+    {
+        return position;
+    }
+
+    [[nodiscard]] std::size_t remaining() const
+    {
+        return position < data.size() ? data.size() - position : 0;
+    }
+
+private:
+    bool rewind(std::size_t start)
+    {
+        position = start;
+        return false;
+    }
+
+    template<typename CharT, typename Alloc>
+    bool read_code_units(std::basic_string<CharT, std::char_traits<CharT>, Alloc>& str, std::size_t code_units)
+    {
+        if (remaining() / sizeof(char16_t) < code_units)
+            return false;
+        byte_order::load_utf16(str, data.data() + position, code_units);
+        position += code_units * sizeof(char16_t);
+        return true;
+    }
+
+    bool read_code_units(std::wstring_view& str, std::size_t code_units)
+    {
+        static_assert(byte_order::is_native_utf16, "Views of UTF-16 data require 2-byte wchar_t, read into std::wstring instead");
+
+        if (remaining() / sizeof(wchar_t) < code_units)
+            return false;
+        str = std::wstring_view(reinterpret_cast<const wchar_t*>(data.data() + position), code_units);
+        position += code_units * sizeof(wchar_t);
+        return true;
+    }
+};
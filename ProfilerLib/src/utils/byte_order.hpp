@@ -0,0 +1,184 @@
+#pragma once
+#include <bit>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <type_traits>
+
+/// <summary>
+/// On-disk encoding shared by the binary serializers: arithmetic values are little-endian,
+/// wide strings are UTF-16LE code units, so files do not depend on the size of wchar_t.
+/// </summary>
+namespace byte_order
+{
+    template<typename T>
+    T byteswap(T value)
+    {
+        if constexpr (sizeof(T) == 1)
+            return value;
+        else
+        {
+            unsigned char bytes[sizeof(T)];
+            std::memcpy(bytes, &value, sizeof(T));
+            for (std::size_t i = 0; i < sizeof(T) / 2; ++i)
+                std::swap(bytes[i], bytes[sizeof(T) - 1 - i]);
+            std::memcpy(&value, bytes, sizeof(T));
+            return value;
+        }
+    }
+
+    /// <summary>
+    /// Stores value into dst in little-endian byte order.
+    /// </summary>
+    template<typename T>
+    void store(void* dst, T value)
+    {
+        static_assert(std::is_arithmetic_v<T> || std::is_enum_v<T>);
+        if constexpr (std::endian::native != std::endian::little)
+            value = byteswap(value);
+        std::memcpy(dst, &value, sizeof(T));
+    }
+
+    /// <summary>
+    /// Loads little-endian value from src, src does not need to be aligned.
+    /// </summary>
+    template<typename T>
+    T load(const void* src)
+    {
+        static_assert(std::is_arithmetic_v<T> || std::is_enum_v<T>);
+        T value;
+        std::memcpy(&value, src, sizeof(T));
+        if constexpr (std::endian::native != std::endian::little)
+            value = byteswap(value);
+        return value;
+    }
+
+    /// <summary>
+    /// Number of bytes of value encoded as LEB128 varint (7 bits per byte, high bit set on all but the last byte).
+    /// </summary>
+    inline std::size_t varint_size(std::uint64_t value)
+    {
+        std::size_t size = 1;
+        for (; value >= 0x80; value >>= 7)
+            ++size;
+        return size;
+    }
+
+    /// <summary>
+    /// Stores value into dst as LEB128 varint, dst must have room for varint_size bytes.
+    /// </summary>
+    inline void store_varint(void* dst, std::uint64_t value)
+    {
+        auto* out = static_cast<unsigned char*>(dst);
+        for (; value >= 0x80; value >>= 7)
+            *out++ = static_cast<unsigned char>(value | 0x80);
+        *out = static_cast<unsigned char>(value);
+    }
+
+    /// <summary>
+    /// Maps signed difference to unsigned value, so small negative differences also make short varints.
+    /// </summary>
+    inline std::uint64_t zigzag_encode(std::int64_t value)
+    {
+        return (static_cast<std::uint64_t>(value) << 1) ^ static_cast<std::uint64_t>(value >> 63);
+    }
+
+    inline std::int64_t zigzag_decode(std::uint64_t value)
+    {
+        return static_cast<std::int64_t>(value >> 1) ^ -static_cast<std::int64_t>(value & 1);
+    }
+
+    /// <summary>
+    /// True if contiguous ranges of T can be copied as they are.
+    /// </summary>
+    template<typename T>
+    constexpr bool is_bulk_copyable = std::endian::native == std::endian::little && (std::is_arithmetic_v<T> || std::is_enum_v<T>);
+
+    /// <summary>
+    /// True if wide strings are UTF-16 in memory (Windows), so they can be copied as they are.
+    /// </summary>
+    constexpr bool is_native_utf16 = sizeof(wchar_t) == sizeof(char16_t) && std::endian::native == std::endian::little;
+
+    /// <summary>
+    /// Number of UTF-16 code units of the string.
+    /// </summary>
+    template<typename CharT>
+    std::size_t utf16_size(const CharT* str, std::size_t size)
+    {
+        if constexpr (sizeof(CharT) == sizeof(char16_t))
+            return size;
+        else
+        {
+            std::size_t result = size;
+            for (std::size_t i = 0; i < size; ++i)
+                result += static_cast<std::uint32_t>(str[i]) > 0xFFFF;
+            return result;
+        }
+    }
+
+    /// <summary>
+    /// Writes the string as UTF-16LE code units to dst, which must have room for utf16_size code units.
+    /// </summary>
+    template<typename CharT>
+    void store_utf16(void* dst, const CharT* str, std::size_t size)
+    {
+        auto* out = static_cast<char*>(dst);
+        if constexpr (sizeof(CharT) == sizeof(char16_t) && std::endian::native == std::endian::little)
+            std::memcpy(out, str, size * sizeof(char16_t));
+        else
+        {
+            for (std::size_t i = 0; i < size; ++i)
+            {
+                auto code_point = static_cast<std::uint32_t>(str[i]);
+                if constexpr (sizeof(CharT) > sizeof(char16_t))
+                {
+                    if (code_point > 0xFFFF)
+                    {
+                        code_point -= 0x10000;
+                        store(out, static_cast<char16_t>(0xD800 + (code_point >> 10)));
+                        out += sizeof(char16_t);
+                        code_point = 0xDC00 + (code_point & 0x3FF);
+                    }
+                }
+                store(out, static_cast<char16_t>(code_point));
+                out += sizeof(char16_t);
+            }
+        }
+    }
+
+    /// <summary>
+    /// Replaces the content of str with code_units UTF-16LE code units from src, keeps the allocator of str.
+    /// </summary>
+    template<typename CharT, typename Traits, typename Alloc>
+    void load_utf16(std::basic_string<CharT, Traits, Alloc>& str, const void* src, std::size_t code_units)
+    {
+        const auto* in = static_cast<const char*>(src);
+        if constexpr (sizeof(CharT) == sizeof(char16_t) && std::endian::native == std::endian::little)
+        {
+            str.resize(code_units);
+            std::memcpy(str.data(), in, code_units * sizeof(char16_t));
+        }
+        else
+        {
+            str.clear();
+            str.reserve(code_units);
+            for (std::size_t i = 0; i < code_units; ++i)
+            {
+                std::uint32_t code_point = load<char16_t>(in + i * sizeof(char16_t));
+                if constexpr (sizeof(CharT) > sizeof(char16_t))
+                {
+                    if (code_point >= 0xD800 && code_point < 0xDC00 && i + 1 < code_units)
+                    {
+                        std::uint32_t low = load<char16_t>(in + (i + 1) * sizeof(char16_t));
+                        if (low >= 0xDC00 && low < 0xE000)
+                        {
+                            code_point = 0x10000 + ((code_point - 0xD800) << 10) + (low - 0xDC00);
+                            ++i;
+                        }
+                    }
+                }
+                str.push_back(static_cast<CharT>(code_point));
+            }
+        }
+    }
+}
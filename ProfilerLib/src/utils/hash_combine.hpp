@@ -0,0 +1,42 @@
+#pragma once
+#include <cstddef>
+#include <functional>
+
+namespace tmt
+{
+    namespace detail
+    {
+        template<typename T, typename F>
+        std::size_t hash_compute(std::size_t seed, const T& value, F hash_t)
+        {
+            return hash_t(value) + 0x9e3779b9 + (seed << 6) + (seed >> 2);
+        }
+
+        template<typename T, typename... Rest>
+        void hash_combine(std::size_t& seed, const T& value, const Rest&... rest)
+        {
+            seed ^= hash_compute(seed, value, std::hash<T>{});
+            (hash_combine(seed, rest), ...);
+        }
+    }
+
+    template<typename T, typename... Rest>
+    std::size_t hash_combine(const T& v, const Rest&... rest)
+    {
+        std::size_t seed = 0;
+        detail::hash_combine(seed, v, rest...);
+        return seed;
+    }
+
+    /// <summary>
+    /// Order dependent hash of all values in the range.
+    /// </summary>
+    template<typename Range, typename F>
+    std::size_t hash_range(const Range& range, F hash_t)
+    {
+        std::size_t seed = 0;
+        for (const auto& value : range)
+            seed ^= detail::hash_compute(seed, value, hash_t);
+        return seed;
+    }
+}
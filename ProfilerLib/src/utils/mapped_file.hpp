@@ -0,0 +1,114 @@
+#pragma once
+#include "byte_order.hpp"
+
+#include <string>
+#include <span>
+#include <cstring>
+#include <cstddef>
+
+#include <Windows.h>
+
+/// <summary>
+/// Read-only view of a whole file mapped into memory.
+/// Empty files are valid, but have no view.
+/// </summary>
+class mapped_file
+{
+    HANDLE file_handle;
+    HANDLE mapping_handle;
+    const std::byte* view;
+    std::size_t view_size;
+    bool valid;
+
+public:
+    explicit mapped_file(const std::wstring& path)
+        : file_handle(CreateFile(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr))
+        , mapping_handle(nullptr), view(nullptr), view_size(0), valid(false)
+    {
+        if (file_handle == INVALID_HANDLE_VALUE)
+            return;
+
+        LARGE_INTEGER file_size;
+        if (!GetFileSizeEx(file_handle, &file_size))
+            return;
+
+        if (file_size.QuadPart == 0)
+        {
+            // Empty file cannot be mapped
+            valid = true;
+            return;
+        }
+
+        mapping_handle = CreateFileMapping(file_handle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (!mapping_handle)
+            return;
+
+        view = static_cast<const std::byte*>(MapViewOfFile(mapping_handle, FILE_MAP_READ, 0, 0, 0));
+        if (view)
+        {
+            view_size = static_cast<std::size_t>(file_size.QuadPart);
+            valid = true;
+        }
+    }
+
+    mapped_file(const mapped_file&) = delete;
+    mapped_file& operator=(const mapped_file&) = delete;
+
+    mapped_file(mapped_file&& other) noexcept
+        : file_handle(other.file_handle), mapping_handle(other.mapping_handle), view(other.view), view_size(other.view_size), valid(other.valid)
+    {
+        other.file_handle = INVALID_HANDLE_VALUE;
+        other.mapping_handle = nullptr;
+        other.view = nullptr;
+        other.view_size = 0;
+        other.valid = false;
+    }
+
+    mapped_file& operator=(mapped_file&& other) = delete;
+
+    ~mapped_file()
+    {
+        if (view)
+            UnmapViewOfFile(view);
+        if (mapping_handle)
+            CloseHandle(mapping_handle);
+        if (file_handle != INVALID_HANDLE_VALUE)
+            CloseHandle(file_handle);
+    }
+
+    [[nodiscard]] std::span<const std::byte> data() const
+    {
+        return { view, view_size };
+    }
+
+    [[nodiscard]] std::size_t size() const
+    {
+        return view_size;
+    }
+
+    /// <summary>
+    /// Reads arithmetic value at given offset, the offset does not need to be aligned.
+    /// Returns false if the value does not fit into the file.
+    /// </summary>
+    template<typename T>
+    bool read(std::size_t offset, T& value) const
+    {
+        if (offset > view_size || view_size - offset < sizeof(T))
+            return false;
+        value = byte_order::load<T>(view + offset);
+        return true;
+    }
+
+    /// <summary>
+    /// Returns true if the file exists and is either empty or successfully mapped.
+    /// </summary>
+    explicit operator bool() const
+    {
+        return valid;
+    }
+
+    bool operator!() const
+    {
+        return !static_cast<bool>(*this);
+    }
+};
@@ -0,0 +1,209 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstddef>
+#include <memory>
+#include <memory_resource>
+#include <new>
+#include <string>
+#include <vector>
+
+#include <Windows.h>
+
+/// <summary>
+/// Memory resource with a memory budget: allocations are served by the upstream resource until they take memory_budget bytes,
+/// the rest is spilled to views of a temporary file (deleted when the resource is destroyed).
+/// Spilled pages are paged by the OS against the file instead of the page file, <see cref="trim"/> evicts them from
+/// the working set, so only the pages touched again (e.g. vertices on the explored path) become resident.
+///
+/// Spilled blocks have power of two sizes and are reused by size class, memory is returned only on destruction.
+/// Released blocks are never coalesced or split: a block freed in one size class is reused only by that class, so the spill
+/// file can hold the peak of every class at once (vectors that keep doubling leave their smaller blocks unused).
+/// Not synchronized, same as std::pmr::unsynchronized_pool_resource, see <see cref="make_worker_resource"/> for other threads.
+/// </summary>
+class spill_memory_resource : public std::pmr::memory_resource
+{
+    static constexpr std::size_t MIN_BLOCK_SIZE = 16;
+    static constexpr std::size_t MAX_BLOCK_ALIGNMENT = 4096;
+    static constexpr std::size_t REGION_SIZE = 64 * 1024 * 1024; // multiple of the allocation granularity
+    static constexpr std::size_t SIZE_CLASSES = 64;
+
+    struct region
+    {
+        HANDLE mapping_handle;
+        std::byte* view;
+        std::size_t size;
+    };
+
+    // Released block is linked through its first bytes
+    struct free_block
+    {
+        free_block* next;
+    };
+
+    std::pmr::memory_resource* upstream;
+    std::size_t memory_budget;
+    std::size_t resident_bytes;
+    std::size_t spilled_bytes;
+
+    std::wstring spill_path;
+    HANDLE file_handle;
+    std::size_t file_size;
+    std::vector<region> regions;
+    std::size_t region_used; // bytes used of the last region
+    std::array<free_block*, SIZE_CLASSES> free_blocks;
+
+public:
+    spill_memory_resource(std::wstring spill_path, std::size_t memory_budget, std::pmr::memory_resource* upstream = std::pmr::get_default_resource())
+        : upstream(upstream), memory_budget(memory_budget), resident_bytes(0), spilled_bytes(0)
+        , spill_path(std::move(spill_path)), file_handle(INVALID_HANDLE_VALUE), file_size(0), region_used(0), free_blocks{}
+    {
+    }
+
+    spill_memory_resource(const spill_memory_resource&) = delete;
+    spill_memory_resource& operator=(const spill_memory_resource&) = delete;
+
+    ~spill_memory_resource() override
+    {
+        for (const auto& [mapping_handle, view, size] : regions)
+        {
+            UnmapViewOfFile(view);
+            CloseHandle(mapping_handle);
+        }
+        if (file_handle != INVALID_HANDLE_VALUE)
+            CloseHandle(file_handle);
+    }
+
+    /// <summary>
+    /// Returns resource for a worker thread building a part of the data in parallel with the other workers.
+    /// The workers share the budget left here and spill to their own files next to the spill file of this resource.
+    /// worker_upstream has to be thread-safe.
+    /// </summary>
+    [[nodiscard]] std::unique_ptr<spill_memory_resource> make_worker_resource(std::size_t worker, std::size_t workers, std::pmr::memory_resource* worker_upstream) const
+    {
+        std::size_t remaining_budget = memory_budget > resident_bytes ? memory_budget - resident_bytes : 0;
+        return std::make_unique<spill_memory_resource>(spill_path + L"." + std::to_wstring(worker), remaining_budget / workers, worker_upstream);
+    }
+
+    /// <summary>
+    /// Removes the spilled pages from the working set, modified ones are written to the spill file.
+    /// </summary>
+    void trim() const
+    {
+        // Unlocking pages that are not locked removes them from the working set
+        for (const auto& [mapping_handle, view, size] : regions)
+            VirtualUnlock(view, size);
+    }
+
+    /// <summary>
+    /// Returns number of bytes allocated from upstream.
+    /// </summary>
+    [[nodiscard]] std::size_t resident_size() const
+    {
+        return resident_bytes;
+    }
+
+    /// <summary>
+    /// Returns number of bytes allocated in the spill file (including released blocks).
+    /// </summary>
+    [[nodiscard]] std::size_t spilled_size() const
+    {
+        return spilled_bytes;
+    }
+
+private:
+    void* do_allocate(std::size_t bytes, std::size_t alignment) override
+    {
+        if (resident_bytes + bytes <= memory_budget || alignment > MAX_BLOCK_ALIGNMENT)
+        {
+            void* ptr = upstream->allocate(bytes, alignment);
+            resident_bytes += bytes;
+            return ptr;
+        }
+
+        std::size_t block_size = std::bit_ceil(std::max({ bytes, alignment, MIN_BLOCK_SIZE }));
+        std::size_t size_class = std::countr_zero(block_size);
+        if (free_block* block = free_blocks[size_class])
+        {
+            free_blocks[size_class] = block->next;
+            return block;
+        }
+
+        return allocate_spilled(block_size);
+    }
+
+    void do_deallocate(void* ptr, std::size_t bytes, std::size_t alignment) override
+    {
+        if (!is_spilled(ptr))
+        {
+            upstream->deallocate(ptr, bytes, alignment);
+            resident_bytes -= bytes;
+            return;
+        }
+
+        std::size_t size_class = std::countr_zero(std::bit_ceil(std::max({ bytes, alignment, MIN_BLOCK_SIZE })));
+        free_blocks[size_class] = new (ptr) free_block{ free_blocks[size_class] };
+    }
+
+    [[nodiscard]] bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override
+    {
+        return this == &other;
+    }
+
+    [[nodiscard]] bool is_spilled(const void* ptr) const
+    {
+        const auto* byte_ptr = static_cast<const std::byte*>(ptr);
+        for (const auto& [mapping_handle, view, size] : regions)
+        {
+            if (byte_ptr >= view && byte_ptr < view + size)
+                return true;
+        }
+        return false;
+    }
+
+    void* allocate_spilled(std::size_t block_size)
+    {
+        // Blocks are aligned to their size (up to a page), so reused blocks satisfy any supported alignment
+        std::size_t offset = (region_used + std::min(block_size, MAX_BLOCK_ALIGNMENT) - 1) & ~(std::min(block_size, MAX_BLOCK_ALIGNMENT) - 1);
+        if (regions.empty() || offset + block_size > regions.back().size)
+        {
+            add_region(std::max(block_size, REGION_SIZE));
+            offset = 0;
+        }
+
+        region_used = offset + block_size;
+        spilled_bytes += block_size;
+        return regions.back().view + offset;
+    }
+
+    void add_region(std::size_t size)
+    {
+        if (file_handle == INVALID_HANDLE_VALUE)
+        {
+            file_handle = CreateFile(spill_path.c_str(), GENERIC_READ | GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS,
+                FILE_ATTRIBUTE_TEMPORARY | FILE_FLAG_DELETE_ON_CLOSE, nullptr);
+            if (file_handle == INVALID_HANDLE_VALUE)
+                throw std::bad_alloc();
+        }
+
+        // Every region maps its own part of the file, mapping extends the file
+        ULARGE_INTEGER offset, end;
+        offset.QuadPart = file_size;
+        end.QuadPart = file_size + size;
+
+        HANDLE mapping_handle = CreateFileMapping(file_handle, nullptr, PAGE_READWRITE, end.HighPart, end.LowPart, nullptr);
+        if (!mapping_handle)
+            throw std::bad_alloc();
+
+        auto* view = static_cast<std::byte*>(MapViewOfFile(mapping_handle, FILE_MAP_ALL_ACCESS, offset.HighPart, offset.LowPart, size));
+        if (!view)
+        {
+            CloseHandle(mapping_handle);
+            throw std::bad_alloc();
+        }
+
+        regions.push_back({ mapping_handle, view, size });
+        file_size += size;
+    }
+};
@@ -1,33 +1,38 @@
 #pragma once
 #include <memory>
 #include <vector>
+#include <array>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <algorithm>
 #include <functional>
+#include <type_traits>
+#include <stdexcept>
+#include <utility>
+#include <unordered_map>
 
-namespace detail
-{
-    template<typename T, typename Alloc, typename... Ts>
-    T* construct(Alloc alloc, Ts&&... ts)
-    {
-        T* ptr = alloc.allocate(1);
-        return new (ptr) T(std::forward<Ts>(ts)...); // cannot use std::construct_at as ctor is private
-    }
+#include "hash_combine.hpp"
 
-    template<typename T, typename Alloc>
-    void destroy(Alloc alloc, T* ptr)
-    {
-        std::destroy_at(ptr);
-        alloc.deallocate(ptr, 1);
-    }
-
-    template<typename T, typename Alloc, typename... Ts>
-    auto allocate_unique(Alloc alloc, Ts&&... ts)
-    {
-        return std::unique_ptr<T, std::function<void(T*)>>(construct<T>(alloc, std::forward<Ts>(ts)...), [alloc](T* ptr) { destroy(alloc, ptr); });
-    }
-}
+/// <summary>
+/// Hash of edges used by <see cref="tree_graph"/> to look up edges of vertices with many children.
+/// Specialize it for an edge type (consistently with EdgeEqual), edges without it are always looked up linearly.
+/// </summary>
+template<typename E>
+struct tree_graph_edge_hash
+{
+};
 
 /// <summary>
 /// Describes an any-ary tree. <seealso cref="tree_graph::graph_vertex"/>
+///
+/// Vertices live in a pool of fixed-size chunks addressed by 32-bit indices, so references to vertices stay valid
+/// while the graph grows, vertices find their graph through the header of their chunk. Every vertex stores the edge
+/// leading to it, children of a vertex are a contiguous range of vertex indices which is doubled when full (released
+/// ranges are reused by other vertices).
+/// Children of vertices with more than INDEX_THRESHOLD children are also indexed by the hash of their edge
+/// (see tree_graph_edge_hash), the order of children is always the order in which they were added.
+/// Subtrees can be collapsed (see collapse), slots of the removed vertices are reused by new ones.
 /// </summary>
 /// <typeparam name="V">Vertex type</typeparam>
 /// <typeparam name="E">Edge type</typeparam>
@@ -36,47 +41,32 @@ namespace detail
 template<typename V, typename E, typename EdgeEqual = std::equal_to<>, typename AllocE = std::allocator<E>>
 class tree_graph
 {
-    EdgeEqual edge_equal;
-    AllocE alloc;
+    using index_t = std::uint32_t;
+    static constexpr index_t NO_INDEX = static_cast<index_t>(-1);
 
-public:
-    tree_graph(EdgeEqual edge_equal, AllocE alloc)
-        : edge_equal(edge_equal), alloc(alloc)
-        , dummy_root(*this, V{})
-    {
-    }
+    static constexpr std::size_t CHUNK_BITS = 10;
+    static constexpr std::size_t CHUNK_SIZE = std::size_t{ 1 } << CHUNK_BITS;
 
-    explicit tree_graph(EdgeEqual edge_equal)
-        : tree_graph(edge_equal, AllocE{})
-    {
-    }
-
-    explicit tree_graph(AllocE alloc)
-        : tree_graph(EdgeEqual{}, alloc)
-    {
-    }
+    static constexpr std::size_t INDEX_THRESHOLD = 8;
 
-    tree_graph()
-        : tree_graph(EdgeEqual{}, AllocE{})
-    {
-    }
+    template<typename Edge>
+    static constexpr bool is_hashable = std::is_invocable_r_v<std::size_t, const tree_graph_edge_hash<E>&, const Edge&>;
 
+public:
     /// <summary>
     /// Vertex of a graph.
     /// </summary>
     class graph_vertex
     {
-        template<typename T, typename Alloc, typename... Ts>
-        friend T* detail::construct(Alloc, Ts&&...);
-
         friend tree_graph;
-        tree_graph& graph;
-
-        using graph_vertex_ptr = std::unique_ptr<graph_vertex, std::function<void(graph_vertex*)>>;
-        using AllocV = typename std::allocator_traits<AllocE>::template rebind_alloc<graph_vertex_ptr>;
 
-        std::vector<graph_vertex_ptr, AllocV> children;
-        graph_vertex* father; // ToDo: copying/moving father vertex will break this ptr
+        E edge; // edge from the father, default constructed for the root
+        index_t index;
+        index_t father;
+        index_t first_child;
+        index_t children_count;
+        index_t children_capacity;
+        bool collapsed;
 
     public:
         /// <summary>
@@ -85,38 +75,30 @@ public:
         V value;
 
     private:
-        std::vector<E, AllocE> edges;
-
-        graph_vertex(tree_graph& graph, V vertex, graph_vertex* father = nullptr)
-            : graph(graph), children(graph.alloc), father(father), value(vertex), edges(graph.alloc)
-        {
-        }
-
-        template<typename Vertex>
-        graph_vertex_ptr create_edge(Vertex&& new_vertex)
+        template<typename Edge, typename Vertex>
+        graph_vertex(Edge&& edge, Vertex&& vertex, index_t index, index_t father)
+            : edge(std::forward<Edge>(edge)), index(index), father(father)
+            , first_child(0), children_count(0), children_capacity(0), collapsed(false), value(std::forward<Vertex>(vertex))
         {
-            using AllocGV = typename std::allocator_traits<AllocV>::template rebind_alloc<graph_vertex>;
-            return detail::allocate_unique<graph_vertex, AllocGV>(graph.alloc, graph, std::forward<Vertex>(new_vertex), this);
         }
 
     public:
+        graph_vertex(const graph_vertex&) = delete;
+        graph_vertex& operator=(const graph_vertex&) = delete;
+
         template<typename Edge, typename Vertex>
         graph_vertex& add_edge(Edge&& new_edge, Vertex&& new_vertex)
         {
+            tree_graph& graph = owner();
+
             // Check if the edge is already there
-            for (std::size_t i = 0; i < edges.size(); ++i)
-            {
-                if (graph.edge_equal(edges[i], new_edge))
-                {
-                    // children[i]->value = std::forward<Vertex>(new_vertex);
-                    return *children[i];
-                }
-            }
+            if (graph_vertex* child = graph.find_child(*this, new_edge))
+                return *child;
 
             // Add new edge
-            edges.push_back(std::forward<Edge>(new_edge));
-            children.push_back(create_edge(std::forward<Vertex>(new_vertex)));
-            return *children.back();
+            index_t child = graph.create_vertex(std::forward<Edge>(new_edge), std::forward<Vertex>(new_vertex), index);
+            graph.push_child(*this, child);
+            return graph.vertex_at(child);
         }
 
         /// <summary>
@@ -124,7 +106,23 @@ public:
         /// </summary>
         [[nodiscard]] graph_vertex* previous_vertex() const
         {
-            return father;
+            return father == NO_INDEX ? nullptr : &owner().vertex_at(father);
+        }
+
+        /// <summary>
+        /// Returns the edge from the father to this vertex, <see cref="previous_vertex"/>
+        /// </summary>
+        [[nodiscard]] const E& previous_edge() const
+        {
+            return edge;
+        }
+
+        /// <summary>
+        /// Returns the edge from the father to this vertex for updating, the members compared by EdgeEqual (and hashed) must stay the same.
+        /// </summary>
+        [[nodiscard]] E& previous_edge()
+        {
+            return edge;
         }
 
         /// <summary>
@@ -132,7 +130,15 @@ public:
         /// </summary>
         [[nodiscard]] std::size_t edges_size() const
         {
-            return edges.size();
+            return children_count;
+        }
+
+        /// <summary>
+        /// Returns true if the children of this vertex were removed by <see cref="tree_graph::collapse"/>.
+        /// </summary>
+        [[nodiscard]] bool is_collapsed() const
+        {
+            return collapsed;
         }
 
         /// <summary>
@@ -140,7 +146,7 @@ public:
         /// </summary>
         [[nodiscard]] const E& get_edge(std::size_t index) const
         {
-            return edges[index];
+            return next_vertex(index).edge;
         }
 
         /// <summary>
@@ -148,20 +154,324 @@ public:
         /// </summary>
         [[nodiscard]] graph_vertex& next_vertex(std::size_t index) const
         {
-            return *children[index];
+            tree_graph& graph = owner();
+            return graph.vertex_at(graph.children[first_child + index]);
+        }
+
+    private:
+        [[nodiscard]] tree_graph& owner() const
+        {
+            return *vertex_chunk::of(this - (index & (CHUNK_SIZE - 1))).graph;
         }
     };
 
+private:
+    /// <summary>
+    /// Chunk of the pool, the header is shared by its vertices instead of each of them pointing to the graph.
+    /// </summary>
+    struct vertex_chunk
+    {
+        tree_graph* graph; // updated when the graph is moved
+        alignas(graph_vertex) std::byte storage[CHUNK_SIZE * sizeof(graph_vertex)];
+
+        [[nodiscard]] graph_vertex* vertices()
+        {
+            return reinterpret_cast<graph_vertex*>(storage);
+        }
+
+        /// <summary>
+        /// Returns the chunk starting with the vertex.
+        /// </summary>
+        static vertex_chunk& of(const graph_vertex* first)
+        {
+            return *reinterpret_cast<vertex_chunk*>(reinterpret_cast<std::byte*>(const_cast<graph_vertex*>(first)) - offsetof(vertex_chunk, storage));
+        }
+    };
+
+    using AllocVertexChunk = typename std::allocator_traits<AllocE>::template rebind_alloc<vertex_chunk>;
+    using AllocChunk = typename std::allocator_traits<AllocE>::template rebind_alloc<vertex_chunk*>;
+    using AllocIndex = typename std::allocator_traits<AllocE>::template rebind_alloc<index_t>;
+    using AllocKey = typename std::allocator_traits<AllocE>::template rebind_alloc<std::pair<const std::size_t, index_t>>;
+
+    // Keys are already hashed
+    struct key_hash
+    {
+        std::size_t operator()(std::size_t key) const
+        {
+            return key;
+        }
+    };
+
+    EdgeEqual edge_equal;
+    tree_graph_edge_hash<E> edge_hash;
+    AllocE alloc;
+
+    std::vector<vertex_chunk*, AllocChunk> chunks;
+    std::size_t vertices_count; // including released vertices
+    std::vector<index_t, AllocIndex> free_vertices;
+
+    // Ranges of children of all vertices, released ranges are linked through their first index (one list per capacity)
+    std::vector<index_t, AllocIndex> children;
+    std::array<index_t, 32> free_ranges;
+
+    // Children of wide vertices by the hash of (father index, edge hash), see INDEX_THRESHOLD
+    std::unordered_multimap<std::size_t, index_t, key_hash, std::equal_to<>, AllocKey> children_index;
+
+public:
+    tree_graph(EdgeEqual edge_equal, AllocE alloc)
+        : edge_equal(edge_equal), alloc(alloc)
+        , chunks(alloc), vertices_count(0), free_vertices(alloc), children(alloc), children_index(alloc)
+    {
+        free_ranges.fill(NO_INDEX);
+        create_vertex(E{}, V{}, NO_INDEX);
+    }
+
+    explicit tree_graph(EdgeEqual edge_equal)
+        : tree_graph(edge_equal, AllocE{})
+    {
+    }
+
+    explicit tree_graph(AllocE alloc)
+        : tree_graph(EdgeEqual{}, alloc)
+    {
+    }
+
+    tree_graph()
+        : tree_graph(EdgeEqual{}, AllocE{})
+    {
+    }
+
+    /// <summary>
+    /// Vertices are taken over without being moved, references to them stay valid. Moved-from graph can only be destroyed.
+    /// </summary>
+    tree_graph(tree_graph&& other) noexcept
+        : edge_equal(std::move(other.edge_equal)), alloc(other.alloc)
+        , chunks(std::move(other.chunks)), vertices_count(std::exchange(other.vertices_count, 0))
+        , free_vertices(std::move(other.free_vertices)), children(std::move(other.children)), free_ranges(other.free_ranges)
+        , children_index(std::move(other.children_index))
+    {
+        for (vertex_chunk* chunk : chunks)
+            chunk->graph = this;
+    }
+
+    tree_graph(const tree_graph&) = delete;
+    tree_graph& operator=(const tree_graph&) = delete;
+    tree_graph& operator=(tree_graph&&) = delete;
+
+    ~tree_graph()
+    {
+        for (std::size_t i = 0; i < vertices_count; ++i)
+            std::destroy_at(&vertex_at(i));
+
+        AllocVertexChunk alloc_chunk(alloc);
+        for (vertex_chunk* chunk : chunks)
+            std::allocator_traits<AllocVertexChunk>::deallocate(alloc_chunk, chunk, 1);
+    }
+
     /// <summary>
     /// Returns the root vertex.
     /// </summary>
     graph_vertex& root()
     {
-        return dummy_root;
+        return vertex_at(0);
+    }
+
+    const graph_vertex& root() const
+    {
+        return vertex_at(0);
+    }
+
+    /// <summary>
+    /// Returns number of vertices including the root.
+    /// </summary>
+    [[nodiscard]] std::size_t vertices_size() const
+    {
+        return vertices_count - free_vertices.size();
+    }
+
+    /// <summary>
+    /// Removes all descendants of the vertex, which is then marked as collapsed (see graph_vertex::is_collapsed).
+    /// References to the removed vertices become invalid.
+    /// </summary>
+    void collapse(graph_vertex& vertex)
+    {
+        std::vector<index_t, AllocIndex> removed(alloc);
+        remove_children(vertex, removed);
+        vertex.collapsed = true;
+
+        while (!removed.empty())
+        {
+            graph_vertex& removed_vertex = vertex_at(removed.back());
+            removed.pop_back();
+            remove_children(removed_vertex, removed);
+
+            // Released slot keeps a reset vertex, so all slots are destroyed the same way
+            removed_vertex.edge = E{};
+            removed_vertex.value = V{};
+            removed_vertex.father = NO_INDEX;
+            removed_vertex.collapsed = false;
+            free_vertices.push_back(removed_vertex.index);
+        }
     }
 
 private:
-    graph_vertex dummy_root;
+    graph_vertex& vertex_at(std::size_t index) const
+    {
+        return chunks[index >> CHUNK_BITS]->vertices()[index & (CHUNK_SIZE - 1)];
+    }
+
+    template<typename Edge>
+    graph_vertex* find_child(const graph_vertex& vertex, const Edge& edge)
+    {
+        if constexpr (is_hashable<Edge>)
+        {
+            if (vertex.children_count > INDEX_THRESHOLD)
+            {
+                auto [first, last] = children_index.equal_range(child_key(vertex.index, edge_hash(edge)));
+                for (; first != last; ++first)
+                {
+                    graph_vertex& child = vertex_at(first->second);
+                    if (child.father == vertex.index && edge_equal(child.edge, edge))
+                        return &child;
+                }
+                return nullptr;
+            }
+        }
+
+        for (std::size_t i = 0; i < vertex.children_count; ++i)
+        {
+            graph_vertex& child = vertex.next_vertex(i);
+            if (edge_equal(child.edge, edge))
+                return &child;
+        }
+        return nullptr;
+    }
+
+    static std::size_t child_key(index_t father, std::size_t hash)
+    {
+        return tmt::hash_combine(father, hash);
+    }
+
+    void index_child(const graph_vertex& vertex, index_t child)
+    {
+        if (vertex.children_count == INDEX_THRESHOLD + 1)
+        {
+            // vertex has just become wide, index all of its children
+            for (std::size_t i = 0; i < vertex.children_count; ++i)
+            {
+                const graph_vertex& indexed = vertex.next_vertex(i);
+                children_index.emplace(child_key(vertex.index, edge_hash(indexed.edge)), indexed.index);
+            }
+        }
+        else if (vertex.children_count > INDEX_THRESHOLD + 1)
+            children_index.emplace(child_key(vertex.index, edge_hash(vertex_at(child).edge)), child);
+    }
+
+    /// <summary>
+    /// Detaches children of the vertex and adds them to removed.
+    /// </summary>
+    void remove_children(graph_vertex& vertex, std::vector<index_t, AllocIndex>& removed)
+    {
+        for (std::size_t i = 0; i < vertex.children_count; ++i)
+        {
+            graph_vertex& child = vertex.next_vertex(i);
+            if constexpr (is_hashable<E>)
+            {
+                if (vertex.children_count > INDEX_THRESHOLD)
+                {
+                    auto [first, last] = children_index.equal_range(child_key(vertex.index, edge_hash(child.edge)));
+                    auto indexed = std::find_if(first, last, [&child](const auto& entry) { return entry.second == child.index; });
+                    if (indexed != last)
+                        children_index.erase(indexed);
+                }
+            }
+            removed.push_back(child.index);
+        }
+
+        if (vertex.children_capacity)
+            release_range(vertex.first_child, vertex.children_capacity);
+        vertex.first_child = 0;
+        vertex.children_count = 0;
+        vertex.children_capacity = 0;
+    }
+
+    template<typename Edge, typename Vertex>
+    index_t create_vertex(Edge&& edge, Vertex&& vertex, index_t father)
+    {
+        if (!free_vertices.empty())
+        {
+            index_t index = free_vertices.back();
+            free_vertices.pop_back();
+
+            graph_vertex& reused = vertex_at(index);
+            reused.edge = std::forward<Edge>(edge);
+            reused.value = std::forward<Vertex>(vertex);
+            reused.father = father;
+            return index;
+        }
+
+        if (vertices_count >= NO_INDEX)
+            throw std::length_error("tree_graph: too many vertices");
+
+        auto index = static_cast<index_t>(vertices_count);
+        if (chunks.size() <= index >> CHUNK_BITS)
+        {
+            chunks.reserve(chunks.size() + 1);
+            AllocVertexChunk alloc_chunk(alloc);
+            vertex_chunk* chunk = std::allocator_traits<AllocVertexChunk>::allocate(alloc_chunk, 1);
+            chunk->graph = this;
+            chunks.push_back(chunk);
+        }
+
+        ::new (static_cast<void*>(&vertex_at(index))) graph_vertex(std::forward<Edge>(edge), std::forward<Vertex>(vertex), index, father);
+        ++vertices_count;
+        return index;
+    }
+
+    void push_child(graph_vertex& vertex, index_t child)
+    {
+        if (vertex.children_count == vertex.children_capacity)
+        {
+            index_t capacity = vertex.children_capacity ? 2 * vertex.children_capacity : 1;
+            index_t range = allocate_range(capacity);
+            std::copy_n(children.begin() + vertex.first_child, vertex.children_count, children.begin() + range);
+
+            if (vertex.children_capacity)
+                release_range(vertex.first_child, vertex.children_capacity);
+            vertex.first_child = range;
+            vertex.children_capacity = capacity;
+        }
+
+        children[vertex.first_child + vertex.children_count++] = child;
+
+        if constexpr (is_hashable<E>)
+            index_child(vertex, child);
+    }
+
+    index_t allocate_range(index_t capacity)
+    {
+        auto& free_range = free_ranges[std::countr_zero(capacity)];
+        if (free_range != NO_INDEX)
+        {
+            index_t range = free_range;
+            free_range = children[range];
+            return range;
+        }
+
+        if (children.size() + capacity >= NO_INDEX)
+            throw std::length_error("tree_graph: too many vertices");
+
+        auto range = static_cast<index_t>(children.size());
+        children.resize(children.size() + capacity);
+        return range;
+    }
+
+    void release_range(index_t range, index_t capacity)
+    {
+        auto& free_range = free_ranges[std::countr_zero(capacity)];
+        children[range] = free_range;
+        free_range = range;
+    }
 };
 
 namespace pmr
@@ -0,0 +1,375 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <iterator>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+/// <summary>
+/// Traversals of <see cref="tree_graph"/> (or any vertex with edges_size/next_vertex) with an explicit stack,
+/// so the depth of the tree is limited by the heap instead of the call stack.
+/// Vertex might be const, the traversal then yields const vertices.
+/// </summary>
+namespace tree_traversal
+{
+    /// <summary>
+    /// Returned by visitors to control the traversal.
+    /// </summary>
+    enum class control : std::uint8_t
+    {
+        CONTINUE,
+        SKIP_CHILDREN, // children of the vertex are not visited (only meaningful before the children are visited)
+        STOP,
+    };
+
+    /// <summary>
+    /// Pre-order iterator, compared with std::default_sentinel for the end.
+    /// </summary>
+    template<typename Vertex>
+    class pre_order_iterator
+    {
+        // path from the start, with the index of the next child to visit
+        std::vector<std::pair<Vertex*, std::size_t>> stack;
+
+    public:
+        using iterator_category = std::input_iterator_tag;
+        using value_type = std::remove_const_t<Vertex>;
+        using difference_type = std::ptrdiff_t;
+        using reference = Vertex&;
+        using pointer = Vertex*;
+
+        explicit pre_order_iterator(Vertex& start)
+            : stack{ { &start, 0 } }
+        {
+        }
+
+        Vertex& operator*() const
+        {
+            return *stack.back().first;
+        }
+
+        Vertex* operator->() const
+        {
+            return stack.back().first;
+        }
+
+        /// <summary>
+        /// Returns depth of the current vertex, the start vertex is at depth 0.
+        /// </summary>
+        [[nodiscard]] std::size_t depth() const
+        {
+            return stack.size() - 1;
+        }
+
+        /// <summary>
+        /// Children of the current vertex are not visited.
+        /// </summary>
+        void skip_children()
+        {
+            stack.back().second = stack.back().first->edges_size();
+        }
+
+        pre_order_iterator& operator++()
+        {
+            while (!stack.empty())
+            {
+                auto& [vertex, next_child] = stack.back();
+                if (next_child < vertex->edges_size())
+                {
+                    Vertex* child = &vertex->next_vertex(next_child++);
+                    stack.emplace_back(child, 0);
+                    return *this;
+                }
+                stack.pop_back();
+            }
+            return *this;
+        }
+
+        void operator++(int)
+        {
+            ++*this;
+        }
+
+        friend bool operator==(const pre_order_iterator& it, std::default_sentinel_t)
+        {
+            return it.stack.empty();
+        }
+    };
+
+    /// <summary>
+    /// Post-order iterator, compared with std::default_sentinel for the end.
+    /// </summary>
+    template<typename Vertex>
+    class post_order_iterator
+    {
+        // path from the start, with the index of the next child to visit
+        std::vector<std::pair<Vertex*, std::size_t>> stack;
+
+    public:
+        using iterator_category = std::input_iterator_tag;
+        using value_type = std::remove_const_t<Vertex>;
+        using difference_type = std::ptrdiff_t;
+        using reference = Vertex&;
+        using pointer = Vertex*;
+
+        explicit post_order_iterator(Vertex& start)
+            : stack{ { &start, 0 } }
+        {
+            descend();
+        }
+
+        Vertex& operator*() const
+        {
+            return *stack.back().first;
+        }
+
+        Vertex* operator->() const
+        {
+            return stack.back().first;
+        }
+
+        /// <summary>
+        /// Returns depth of the current vertex, the start vertex is at depth 0.
+        /// </summary>
+        [[nodiscard]] std::size_t depth() const
+        {
+            return stack.size() - 1;
+        }
+
+        post_order_iterator& operator++()
+        {
+            stack.pop_back();
+            if (!stack.empty())
+                descend();
+            return *this;
+        }
+
+        void operator++(int)
+        {
+            ++*this;
+        }
+
+        friend bool operator==(const post_order_iterator& it, std::default_sentinel_t)
+        {
+            return it.stack.empty();
+        }
+
+    private:
+        // Goes down to the first vertex whose children are all visited
+        void descend()
+        {
+            while (stack.back().second < stack.back().first->edges_size())
+            {
+                auto& [vertex, next_child] = stack.back();
+                Vertex* child = &vertex->next_vertex(next_child++);
+                stack.emplace_back(child, 0);
+            }
+        }
+    };
+
+    /// <summary>
+    /// Breadth-first iterator, compared with std::default_sentinel for the end.
+    /// </summary>
+    template<typename Vertex>
+    class breadth_first_iterator
+    {
+        // visited vertex is at the front, with its depth
+        std::deque<std::pair<Vertex*, std::size_t>> queue;
+        bool skip;
+
+    public:
+        using iterator_category = std::input_iterator_tag;
+        using value_type = std::remove_const_t<Vertex>;
+        using difference_type = std::ptrdiff_t;
+        using reference = Vertex&;
+        using pointer = Vertex*;
+
+        explicit breadth_first_iterator(Vertex& start)
+            : queue{ { &start, 0 } }, skip(false)
+        {
+        }
+
+        Vertex& operator*() const
+        {
+            return *queue.front().first;
+        }
+
+        Vertex* operator->() const
+        {
+            return queue.front().first;
+        }
+
+        /// <summary>
+        /// Returns depth of the current vertex, the start vertex is at depth 0.
+        /// </summary>
+        [[nodiscard]] std::size_t depth() const
+        {
+            return queue.front().second;
+        }
+
+        /// <summary>
+        /// Children of the current vertex are not visited.
+        /// </summary>
+        void skip_children()
+        {
+            skip = true;
+        }
+
+        breadth_first_iterator& operator++()
+        {
+            auto [vertex, depth] = queue.front();
+            queue.pop_front();
+            if (!std::exchange(skip, false))
+            {
+                for (std::size_t i = 0; i < vertex->edges_size(); ++i)
+                    queue.emplace_back(&vertex->next_vertex(i), depth + 1);
+            }
+            return *this;
+        }
+
+        void operator++(int)
+        {
+            ++*this;
+        }
+
+        friend bool operator==(const breadth_first_iterator& it, std::default_sentinel_t)
+        {
+            return it.queue.empty();
+        }
+    };
+
+    /// <summary>
+    /// Range of a traversal, the iterator is kept by a range-for loop (use begin() for skip_children).
+    /// </summary>
+    template<typename Iterator>
+    class range
+    {
+        Iterator first;
+
+    public:
+        explicit range(Iterator first)
+            : first(std::move(first))
+        {
+        }
+
+        Iterator begin() const
+        {
+            return first;
+        }
+
+        std::default_sentinel_t end() const
+        {
+            return {};
+        }
+    };
+
+    template<typename Vertex>
+    range<pre_order_iterator<Vertex>> pre_order(Vertex& start)
+    {
+        return range(pre_order_iterator<Vertex>(start));
+    }
+
+    template<typename Vertex>
+    range<post_order_iterator<Vertex>> post_order(Vertex& start)
+    {
+        return range(post_order_iterator<Vertex>(start));
+    }
+
+    template<typename Vertex>
+    range<breadth_first_iterator<Vertex>> breadth_first(Vertex& start)
+    {
+        return range(breadth_first_iterator<Vertex>(start));
+    }
+
+    namespace details
+    {
+        // Visitors returning void always continue
+        template<typename F, typename Vertex>
+        control call(F& f, Vertex& vertex, std::size_t depth)
+        {
+            if constexpr (std::is_void_v<std::invoke_result_t<F&, Vertex&, std::size_t>>)
+            {
+                f(vertex, depth);
+                return control::CONTINUE;
+            }
+            else
+                return f(vertex, depth);
+        }
+    }
+
+    /// <summary>
+    /// Calls on_enter(vertex, depth) before the children of a vertex and on_leave(vertex, depth) after them
+    /// (also when they were skipped). Visitors return <see cref="control"/> or void.
+    /// Returns false if a visitor stopped the traversal.
+    /// </summary>
+    template<typename Vertex, typename Enter, typename Leave>
+    bool visit_depth_first(Vertex& start, Enter on_enter, Leave on_leave)
+    {
+        // path from the start, with the index of the next child to visit
+        std::vector<std::pair<Vertex*, std::size_t>> stack;
+
+        auto enter = [&](Vertex& vertex)
+        {
+            control result = details::call(on_enter, vertex, stack.size());
+            stack.emplace_back(&vertex, result == control::SKIP_CHILDREN ? vertex.edges_size() : 0);
+            return result != control::STOP;
+        };
+
+        if (!enter(start))
+            return false;
+
+        while (!stack.empty())
+        {
+            auto& [vertex, next_child] = stack.back();
+            if (next_child < vertex->edges_size())
+            {
+                if (!enter(vertex->next_vertex(next_child++)))
+                    return false;
+                continue;
+            }
+
+            Vertex& left = *vertex;
+            stack.pop_back();
+            if (details::call(on_leave, left, stack.size()) == control::STOP)
+                return false;
+        }
+        return true;
+    }
+
+    /// <summary>
+    /// Calls f(vertex, depth) for every vertex in pre-order, returns false if f stopped the traversal.
+    /// </summary>
+    template<typename Vertex, typename F>
+    bool visit_pre_order(Vertex& start, F f)
+    {
+        return visit_depth_first(start, f, [](Vertex&, std::size_t) {});
+    }
+
+    /// <summary>
+    /// Calls f(vertex, depth) for every vertex in post-order, returns false if f stopped the traversal.
+    /// </summary>
+    template<typename Vertex, typename F>
+    bool visit_post_order(Vertex& start, F f)
+    {
+        return visit_depth_first(start, [](Vertex&, std::size_t) {}, f);
+    }
+
+    /// <summary>
+    /// Calls f(vertex, depth) for every vertex level by level, returns false if f stopped the traversal.
+    /// </summary>
+    template<typename Vertex, typename F>
+    bool visit_breadth_first(Vertex& start, F f)
+    {
+        for (auto it = breadth_first_iterator<Vertex>(start); it != std::default_sentinel; ++it)
+        {
+            control result = details::call(f, *it, it.depth());
+            if (result == control::STOP)
+                return false;
+            if (result == control::SKIP_CHILDREN)
+                it.skip_children();
+        }
+        return true;
+    }
+}
@@ -1,6 +1,8 @@
 #include <utils/binary_fstream.hpp>
 #include <utils/tree_graph.hpp>
+#include <utils/tree_traversal.hpp>
 #include <thread_interleaving_control/trace.hpp>
+#include <thread_interleaving_control/trace_store.hpp>
 
 #include <iostream>
 #include <iomanip>
@@ -17,7 +19,7 @@ T read_value(binary_fstream& str)
     return t;
 }
 
-static constexpr std::size_t BLOCKS_SIZE = 256;
+static constexpr std::size_t BLOCKS_SIZE = trace_format::BLOCKS_SIZE;
 
 template<typename T>
 class nice_hex_manip
@@ -47,9 +49,9 @@ nice_hex_manip<T> nice_hex(T&& t)
     return nice_hex_manip<T>(std::forward<T>(t));
 }
 
-void process_vertex(const tree_graph<int, past_trace_item>::graph_vertex& vertex, const std::wstring& edge_desc = L"", int depth = 1)
+void process_vertex(const tree_graph<int, past_trace_item>::graph_vertex& root)
 {
-    auto start_line = [](int depth) -> std::wostream& { return std::wcout << std::wstring(depth * 2, L' '); };
+    auto start_line = [](std::size_t depth) -> std::wostream& { return std::wcout << std::wstring(depth * 2, L' '); };
     auto make_edge_desc = [](const std::wstring& desc)
     {
         static std::wregex regex(L".*\\.([^(]+)\\(.*");
@@ -64,38 +66,95 @@ void process_vertex(const tree_graph<int, past_trace_item>::graph_vertex& vertex
         return L", EL=" + updated_desc;
     };
 
-    start_line(depth) << L"[" << vertex.value << edge_desc;
-
-    if (vertex.edges_size() == 0)
-        std::wcout << L"]";
-    else
-    {
-        std::wcout << std::endl;
-        for (std::size_t i = 0; i < vertex.edges_size(); ++i)
-            process_vertex(vertex.next_vertex(i), make_edge_desc(vertex.get_edge(i).function_id), depth + 1);
-        start_line(depth) << L"]";
-    }
-    std::wcout << std::endl;
+    // Graphs are as deep as the longest trace, so they are not walked recursively
+    tree_traversal::visit_depth_first(root,
+        [&](const auto& vertex, std::size_t depth)
+        {
+            start_line(depth + 1) << L"[" << vertex.value << (depth > 0 ? make_edge_desc(std::wstring(vertex.previous_edge().function_id())) : L"");
+            if (vertex.edges_size() == 0)
+                std::wcout << L"]";
+            std::wcout << std::endl;
+        },
+        [&](const auto& vertex, std::size_t depth)
+        {
+            if (vertex.edges_size() > 0)
+                start_line(depth + 1) << L"]" << std::endl;
+        });
 }
 
 void compute_vertex_ids(std::unordered_map<const tree_graph<int, past_trace_item>::graph_vertex*, int>& mapping, const tree_graph<int, past_trace_item>::graph_vertex& vertex)
 {
     static int id = 0;
 
-    mapping[&vertex] = id++;
-    for (std::size_t i = 0; i < vertex.edges_size(); ++i)
-        compute_vertex_ids(mapping, vertex.next_vertex(i));
+    for (const auto& visited : tree_traversal::pre_order(vertex))
+        mapping[&visited] = id++;
 }
 
-void process_graph(binary_fstream&& stream)
+void process_graph(const std::wstring& path)
 {
-    trace_file trace_file(std::move(stream));
+    // Includes the segments of the data file, if any
+    mapped_trace_store trace_store(path);
+    if (!trace_store)
+    {
+        std::wcout << L"Corrupted file" << std::endl;
+        return;
+    }
+
     tree_graph<int, past_trace_item> call_graph;
-    trace_file.populate_call_graph(call_graph);
+    trace_store.populate_call_graph(call_graph);
 
     process_vertex(call_graph.root());
 }
 
+int process_dictionary_format(const std::wstring& path, bool no_trace_requested, const std::vector<int>& requested_traces)
+{
+    mapped_trace_file trace_file(path);
+    if (!trace_file)
+    {
+        std::wcout << L"Corrupted file" << std::endl;
+        return 1;
+    }
+
+    std::wcout << L"Format version: " << static_cast<std::uint32_t>(trace_file.get_version()) << std::endl;
+    std::wcout << L"Traces count: " << trace_file.traces_size() << std::endl;
+
+    const auto& dictionary = trace_file.get_dictionary();
+    std::wcout << L"Dictionary [" << dictionary.size() << L"]" << std::endl;
+    for (std::size_t i = 0; i < dictionary.size(); ++i)
+        std::wcout << L"  " << std::setw(3) << i << L" " << dictionary[i] << std::endl;
+
+    std::vector<std::vector<past_trace_item>> traces(trace_file.traces_size());
+    for (std::size_t i = 0; i < traces.size(); ++i)
+    {
+        trace_file.get_trace(i, traces[i]);
+
+        if (no_trace_requested || std::ranges::find(requested_traces, i) != requested_traces.end())
+        {
+            std::wcout << L"  Trace " << i << L" details: [" << traces[i].size() << L"] at " << nice_hex(trace_file.get_trace_offset(i)) << std::endl;
+
+            trace_file.for_each_item(i, [](const past_trace_item_view& item)
+            {
+                std::wcout << L"    " << std::setw(3) << item.counted_id << L" " << std::setw(3) << item.function_index << L" " << item.function_id << L" [" << item.options_size << L"]";
+                if (item.backtrack != 0)
+                    std::wcout << L" backtrack " << nice_hex(item.backtrack);
+                if (item.asleep != 0)
+                    std::wcout << L" asleep " << nice_hex(item.asleep);
+                std::wcout << std::endl;
+            });
+
+            std::wcout << std::endl << std::endl;
+        }
+    }
+
+    for (std::size_t i = 0; i < traces.size(); ++i)
+    for (std::size_t j = i + 1; j < traces.size(); ++j)
+    {
+        if (std::ranges::find(requested_traces, i) != requested_traces.end() && traces[i] == traces[j])
+            std::wcout << L"  Trace " << i << L" and " << j << L" is the same" << std::endl;
+    }
+    return 0;
+}
+
 int wmain(int argc, wchar_t* argv[])
 {
     if (argc <= 1)
@@ -113,7 +172,7 @@ int wmain(int argc, wchar_t* argv[])
 
     if (argc > 2 && argv[2] == std::wstring(L"--graph"))
     {
-        process_graph(std::move(stream));
+        process_graph(argv[1]);
         return 0;
     }
 
@@ -123,6 +182,10 @@ int wmain(int argc, wchar_t* argv[])
         requested_traces.push_back(std::stoi(argv[i]));
 
     std::wcout << L"Is empty: " << std::boolalpha << stream.is_empty_file() << std::endl;
+
+    if (mapped_trace_file(argv[1]).get_version() != trace_format::version_t::V1)
+        return process_dictionary_format(argv[1], no_trace_requested, requested_traces);
+
     stream.seek(std::ios::beg);
 
     auto count = read_value<std::size_t>(stream);
@@ -159,8 +222,8 @@ int wmain(int argc, wchar_t* argv[])
             {
                 std::wcout << L"  Trace " << BLOCKS_SIZE * cur_block + i << L" details: [" << cur_trace.size() << L"] at " << nice_hex(cur_pos) << std::endl;
 
-                for (auto [counted_id, function_id, options_size] : cur_trace)
-                    std::wcout << L"    " << std::setw(3) << counted_id << L" " << function_id << L" [" << options_size << L"]" << std::endl;
+                for (const auto& item : cur_trace)
+                    std::wcout << L"    " << std::setw(3) << item.counted_id << L" " << item.function_id() << L" [" << item.options_size << L"]" << std::endl;
 
                 std::wcout << std::endl << std::endl;
             }
@@ -0,0 +1,123 @@
+#include <iostream>
+#include <unordered_map>
+#include <filesystem>
+#include <ranges>
+#include <thread_interleaving_control/trace.hpp>
+#include <thread_interleaving_control/trace_dedup.hpp>
+#include <thread_interleaving_control/trace_store.hpp>
+
+int wmain(int argc, wchar_t* argv[])
+{
+    if (argc <= 2)
+    {
+        std::wcerr << L"Usage: " << argv[0] << L" output_data_file input_data_file..." << std::endl;
+        return 1;
+    }
+
+    std::wstring output_path = argv[1];
+    if (std::error_code ec; std::filesystem::exists(output_path, ec) && !std::filesystem::is_empty(output_path, ec))
+    {
+        std::wcerr << L"'" << output_path << L"' already exists" << std::endl;
+        return 1;
+    }
+
+    trace_file output(output_path);
+    if (!output)
+    {
+        std::wcerr << L"'" << output_path << L"' cannot be created" << std::endl;
+        return 1;
+    }
+
+    // Same exact equality as "Unique traces" of TraceFileStats, only fingerprints and hit counts are kept in memory,
+    // candidates with the same fingerprint are compared with the already merged traces in the output.
+    // Fingerprints are stored in the sidecar, so deduplicated appends to the output do not compute them again.
+    std::unordered_map<std::uint64_t, std::vector<std::size_t>> merged_by_fingerprint;
+    std::vector<std::size_t> hits;
+    std::vector<std::uint64_t> fingerprints;
+    std::size_t input_traces = 0;
+    std::size_t unique_traces = 0;
+
+    std::vector<past_trace_item_view> trace;
+    std::vector<past_trace_item> merged_trace;
+
+    for (int arg = 2; arg < argc; ++arg)
+    {
+        auto segments = trace_store::segment_paths(argv[arg]);
+        if (segments.empty())
+        {
+            std::wcerr << L"'" << argv[arg] << L"' is not a valid file" << std::endl;
+            return 1;
+        }
+
+        // Segments are mapped one by one, inputs do not need to fit into the address space together
+        for (const auto& segment_path : segments)
+        {
+            mapped_trace_file input(segment_path);
+            if (!input)
+            {
+                std::wcerr << L"'" << segment_path << L"' is not a valid file" << std::endl;
+                return 1;
+            }
+
+            auto input_hits = trace_dedup::read_hits(segment_path, input.traces_size());
+            for (std::size_t i = 0; i < input.traces_size(); ++i)
+            {
+                trace.clear();
+                input.for_each_item(i, [&trace](const past_trace_item_view& item) { trace.push_back(item); });
+                ++input_traces;
+
+                trace_format::fingerprint fingerprint;
+                for (const auto& item : trace)
+                    fingerprint.add(item.counted_id, item.function_id);
+
+                // The last merged trace of a schedule has the backtrack and asleep threads of the earlier ones, a trace with new threads
+                // is merged as a new trace with the threads of both (see trace_file::find_stored)
+                auto& candidates = merged_by_fingerprint[fingerprint.get()];
+                auto same = std::ranges::find_if(candidates | std::views::reverse, [&](std::size_t merged_index)
+                {
+                    output.get_trace(merged_index, merged_trace);
+                    return std::ranges::equal(merged_trace, trace);
+                });
+
+                if (same != std::ranges::rend(candidates))
+                {
+                    // merged_trace is the trace found
+                    if (std::ranges::equal(merged_trace, trace, [](const past_trace_item& merged, const past_trace_item_view& item)
+                    {
+                        return (item.backtrack & ~merged.backtrack) == 0 && (item.asleep & ~merged.asleep) == 0;
+                    }))
+                    {
+                        hits[*same] += input_hits[i];
+                        continue;
+                    }
+
+                    for (std::size_t j = 0; j < trace.size(); ++j)
+                    {
+                        merged_trace[j].backtrack |= trace[j].backtrack;
+                        merged_trace[j].asleep |= trace[j].asleep;
+                    }
+                }
+                else
+                {
+                    ++unique_traces;
+                    merged_trace.assign(trace.begin(), trace.end());
+                }
+
+                candidates.push_back(hits.size());
+                hits.push_back(input_hits[i]);
+                fingerprints.push_back(fingerprint.get());
+                output.append_trace(merged_trace);
+            }
+        }
+    }
+
+    if (!output || !trace_dedup::write_hits(output_path, hits) || !trace_dedup::write_fingerprints(output_path, fingerprints))
+    {
+        std::wcerr << L"Writing '" << output_path << L"' failed" << std::endl;
+        return 1;
+    }
+
+    std::wcout << L"Input traces: " << input_traces << std::endl;
+    std::wcout << L"Unique traces: " << unique_traces << std::endl;
+    return 0;
+}
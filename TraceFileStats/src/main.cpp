@@ -1,44 +1,14 @@
 #include <iostream>
 #include <unordered_map>
 #include <thread_interleaving_control/trace.hpp>
+#include <thread_interleaving_control/trace_dedup.hpp>
+#include <thread_interleaving_control/trace_store.hpp>
 #include <utils/wstring_join.hpp>
+#include <utils/hash_combine.hpp>
 #include <typeinfo>
 
 using single_trace = std::vector<past_trace_item>;
 
-namespace detail
-{
-    template<typename T, typename F>
-    std::size_t hash_compute(std::size_t seed, const T& value, F hash_t)
-    {
-        return hash_t(value) + 0x9e3779b9 + (seed << 6) + (seed >> 2);
-    }
-
-    template<typename T, typename... Rest>
-    void hash_combine(std::size_t& seed, const T& value, const Rest&... rest)
-    {
-        seed ^= hash_compute(seed, value, std::hash<T>{});
-        (hash_combine(seed, rest), ...);
-    }
-}
-
-template<typename T, typename... Rest>
-std::size_t hash_combine(const T& v, const Rest&... rest)
-{
-    std::size_t seed = 0;
-    detail::hash_combine(seed, v, rest...);
-    return seed;
-}
-
-template<typename T, typename F>
-std::size_t hash_vector(const std::vector<T>& vector, F hash_t)
-{
-    std::size_t seed = 0;
-    for (const T& value : vector)
-        seed ^= detail::hash_compute(seed, value, hash_t);
-    return seed;
-}
-
 template<typename Key, typename Value, typename Hash, typename Compare = std::equal_to<Key>>
 std::unordered_map<Key, Value, Hash, Compare> make_unordered_map(Hash hash, Compare compare = Compare{})
 {
@@ -53,7 +23,8 @@ int wmain(int argc, wchar_t* argv[])
         return 1;
     }
 
-    trace_file trace_log(argv[1], binary_fstream::input);
+    // Includes the segments of the data file, if any
+    mapped_trace_store trace_log(argv[1]);
 
     if (!trace_log)
     {
@@ -84,8 +55,8 @@ int wmain(int argc, wchar_t* argv[])
     }
     std::wcout << std::endl;
 
-    auto hash_trace_exact = [](const past_trace_item& item) { return hash_combine(item.counted_id, item.function_id); };
-    auto make_vector_hasher = [](auto& hash_func) { return [hash_func](const single_trace& vec) { return hash_vector(vec, hash_func); }; };
+    auto hash_trace_exact = past_trace_item_hash{};
+    auto make_vector_hasher = [](auto& hash_func) { return [hash_func](const single_trace& vec) { return tmt::hash_range(vec, hash_func); }; };
 
     auto compare_exact = [](const single_trace& t1, const single_trace& t2) { return std::ranges::equal(t1, t2); };
     
@@ -95,6 +66,15 @@ int wmain(int argc, wchar_t* argv[])
         same_traces[traces[i]].push_back(i);
 
     std::wcout << L"Unique traces" << L": " << same_traces.size() << std::endl;
+
+    // Deduplicated traces stand for several runs (see data_file_dedup in profiler.conf.sample)
+    auto segment_paths = trace_store::segment_paths(argv[1]);
+    std::size_t recorded_runs = 0;
+    for (std::size_t i = 0; i < trace_log.segments_size(); ++i)
+        for (std::size_t hits : trace_dedup::read_hits(segment_paths[i], trace_log.get_segment(i).traces_size()))
+            recorded_runs += hits;
+    std::wcout << L"Recorded runs: " << recorded_runs << std::endl;
+
     if (debug)
     {
         std::wcout << L"{" << std::endl;